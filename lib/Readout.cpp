@@ -1,9 +1,34 @@
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <tuple>
 
 #include "Readout.h"
 #include "ReadoutClass.h"
 #include "efu_time.h"
 
+namespace {
+  // A Readout object shared by name, and what it was created for
+  struct Attachment {
+    readout_t * r_ptr;
+    std::string address;
+    int port;
+    int type;
+    int count;
+  };
+  std::mutex registry_mutex;
+  std::map<std::string, Attachment> registry;
+
+  // A pulse clock shared by name
+  struct ClockAttachment {
+    pulse_clock_t * c_ptr;
+    double frequency;
+    int count;
+  };
+  std::map<std::string, ClockAttachment> clocks;
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -12,6 +37,9 @@ extern "C" {
 //    void *rep;
     void *time;
   };
+  struct pulse_clock{
+    std::shared_ptr<PulseClock> clock;
+  };
 
   // Create a new Readout object
   readout_t * readout_create(const char* address, const int port, const int command_port, const double source_frequency, int type){
@@ -21,9 +49,41 @@ extern "C" {
     return r_ptr;
   }
 
+  // Attach to a named Readout object, creating it if necessary
+  readout_t * readout_attach(const char * name, const char* address, const int port, const int command_port, const double source_frequency, int type){
+    if (name == nullptr || address == nullptr) return nullptr;
+    std::lock_guard lock(registry_mutex);
+    if (auto found = registry.find(name); found != registry.end()) {
+      auto & attachment = found->second;
+      // the caller reports the mismatch, if it wants to
+      if (attachment.address != address || attachment.port != port || attachment.type != type) return nullptr;
+      ++attachment.count;
+      return attachment.r_ptr;
+    }
+    auto r_ptr = readout_create(address, port, command_port, source_frequency, type);
+    registry.emplace(name, Attachment{r_ptr, address, port, type, 1});
+    return r_ptr;
+  }
+
+  int readout_attachments(readout_t * r_ptr){
+    std::lock_guard lock(registry_mutex);
+    for (const auto & [name, attachment]: registry) if (attachment.r_ptr == r_ptr) return attachment.count;
+    return 0;
+  }
+
   // Destroy an existing Readout object
   void readout_destroy(readout_t* r_ptr){
     if (r_ptr == nullptr) return;
+    {
+      std::lock_guard lock(registry_mutex);
+      for (auto attachment = registry.begin(); attachment != registry.end(); ++attachment) {
+        if (attachment->second.r_ptr != r_ptr) continue;
+        // the last attachment destroys the object
+        if (--attachment->second.count) return;
+        registry.erase(attachment);
+        break;
+      }
+    }
     delete static_cast<Readout*>(r_ptr->obj);
     free(r_ptr);
   }
@@ -37,6 +97,63 @@ extern "C" {
     obj->addReadout(ring, fen, time_of_flight, weight, data);
   }
 
+  int readout_add_caen(readout_t * r_ptr, const uint8_t ring, const uint8_t fen, const double time_of_flight, const double weight, const CAEN_readout_t * data){
+    if (r_ptr == nullptr || data == nullptr) return -1;
+    readout_setPulseTime(r_ptr);
+    return static_cast<Readout *>(r_ptr->obj)->add(ring, fen, time_of_flight, weight, *data);
+  }
+  int readout_add_ttlmonitor(readout_t * r_ptr, const uint8_t ring, const uint8_t fen, const double time_of_flight, const double weight, const TTLMonitor_readout_t * data){
+    if (r_ptr == nullptr || data == nullptr) return -1;
+    readout_setPulseTime(r_ptr);
+    return static_cast<Readout *>(r_ptr->obj)->add(ring, fen, time_of_flight, weight, *data);
+  }
+  int readout_add_dream(readout_t * r_ptr, const uint8_t ring, const uint8_t fen, const double time_of_flight, const double weight, const DREAM_readout_t * data){
+    if (r_ptr == nullptr || data == nullptr) return -1;
+    readout_setPulseTime(r_ptr);
+    return static_cast<Readout *>(r_ptr->obj)->add(ring, fen, time_of_flight, weight, *data);
+  }
+  int readout_add_vmm3(readout_t * r_ptr, const uint8_t ring, const uint8_t fen, const double time_of_flight, const double weight, const VMM3_readout_t * data){
+    if (r_ptr == nullptr || data == nullptr) return -1;
+    readout_setPulseTime(r_ptr);
+    return static_cast<Readout *>(r_ptr->obj)->add(ring, fen, time_of_flight, weight, *data);
+  }
+
+  // Add many readout values to the transmission buffer of the Readout object
+  void readout_add_batch(readout_t * r_ptr, const size_t count, const uint8_t * ring, const uint8_t * fen,
+                         const double * time_of_flight, const double * weight, const void * columns){
+    if (r_ptr == nullptr) return;
+    readout_setPulseTime(r_ptr);
+    const auto obj = static_cast<Readout *>(r_ptr->obj);
+    obj->addReadouts(count, ring, fen, time_of_flight, weight, columns);
+  }
+
+  CaenData * readout_reserve_caen(readout_t * r_ptr, const uint8_t ring, const uint8_t fen, const double time_of_flight){
+    if (r_ptr == nullptr) return nullptr;
+    readout_setPulseTime(r_ptr);
+    return static_cast<Readout *>(r_ptr->obj)->reserveReadout<CAEN_readout_t>(ring, fen, time_of_flight);
+  }
+  TTLMonitorData * readout_reserve_ttlmonitor(readout_t * r_ptr, const uint8_t ring, const uint8_t fen, const double time_of_flight){
+    if (r_ptr == nullptr) return nullptr;
+    readout_setPulseTime(r_ptr);
+    return static_cast<Readout *>(r_ptr->obj)->reserveReadout<TTLMonitor_readout_t>(ring, fen, time_of_flight);
+  }
+  DreamData * readout_reserve_dream(readout_t * r_ptr, const uint8_t ring, const uint8_t fen, const double time_of_flight){
+    if (r_ptr == nullptr) return nullptr;
+    readout_setPulseTime(r_ptr);
+    return static_cast<Readout *>(r_ptr->obj)->reserveReadout<DREAM_readout_t>(ring, fen, time_of_flight);
+  }
+  VMM3Data * readout_reserve_vmm3(readout_t * r_ptr, const uint8_t ring, const uint8_t fen, const double time_of_flight){
+    if (r_ptr == nullptr) return nullptr;
+    readout_setPulseTime(r_ptr);
+    return static_cast<Readout *>(r_ptr->obj)->reserveReadout<VMM3_readout_t>(ring, fen, time_of_flight);
+  }
+  // Include the reserved readout in the packet
+  void readout_commit(readout_t * r_ptr){
+    if (r_ptr == nullptr) return;
+    const auto obj = static_cast<Readout *>(r_ptr->obj);
+    obj->commitReadout();
+  }
+
   // Send the current data buffer for the Readout object
   void readout_send(readout_t* r_ptr)
   {
@@ -44,6 +161,7 @@ extern "C" {
     if (r_ptr == nullptr) return;
     obj = static_cast<Readout*>(r_ptr->obj);
     obj->send();
+    obj->flush();
   }
   // Update the pulse and previous pulse times for the Readout object
   void readout_setPulseTime(readout_t* r_ptr)
@@ -136,6 +254,258 @@ void readout_enable_network(readout_t * r_ptr){
   return obj->enable_network();
 }
 
+int readout_set_transport(readout_t * r_ptr, const int transport, const int batch, const int flush_on_pulse){
+  Readout * obj;
+  if (r_ptr == nullptr) return -1;
+  if (transport < READOUT_TRANSPORT_UDP || transport > READOUT_TRANSPORT_URING) return -1;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return obj->set_transport(static_cast<readout_transport>(transport), batch > 0 ? batch : 1, flush_on_pulse != 0);
+}
+
+int readout_set_sender_thread(readout_t * r_ptr, const int depth, const int full_ring){
+  Readout * obj;
+  if (r_ptr == nullptr) return -1;
+  if (full_ring < READOUT_FULL_RING_BLOCK || full_ring > READOUT_FULL_RING_GROW) return -1;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->set_sender_thread(depth > 0 ? depth : 0, static_cast<readout_full_ring>(full_ring));
+  return 0;
+}
+
+int readout_set_pacing(readout_t * r_ptr, const int unit, const double rate, const double burst){
+  Readout * obj;
+  if (r_ptr == nullptr) return -1;
+  if (unit < READOUT_PACING_NONE || unit > READOUT_PACING_BYTES) return -1;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->set_pacing(rate > 0 ? static_cast<readout_pacing>(unit) : READOUT_PACING_NONE, rate, burst > 0 ? burst : 0.);
+  return 0;
+}
+
+double readout_throttled_time(readout_t * r_ptr){
+  Readout * obj;
+  if (r_ptr == nullptr) return 0.;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return std::chrono::duration<double>(obj->throttled()).count();
+}
+
+void readout_enable_pulse_bursts(readout_t * r_ptr, const double delay){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  const auto requested = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(delay));
+  obj->enable_pulse_bursts(delay < 0 ? obj->pulse_period() : requested);
+}
+
+void readout_disable_pulse_bursts(readout_t * r_ptr){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->disable_pulse_bursts();
+}
+
+void readout_set_multicast(readout_t * r_ptr, const int ttl, const char * interface_address, const int loop){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->set_multicast(MulticastOptions{ttl, interface_address == nullptr ? std::string() : std::string(interface_address), loop != 0});
+}
+
+size_t readout_missed_deadlines(readout_t * r_ptr){
+  Readout * obj;
+  if (r_ptr == nullptr) return 0;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return obj->missed_deadlines();
+}
+
+int readout_add_destination(readout_t * r_ptr, const char * address, const int port){
+  Readout * obj;
+  if (r_ptr == nullptr || address == nullptr) return -1;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return obj->add_destination(address, port);
+}
+
+int readout_set_sharding(readout_t * r_ptr, const int by){
+  Readout * obj;
+  if (r_ptr == nullptr) return -1;
+  if (by < READOUT_SHARD_NONE || by > READOUT_SHARD_FEN) return -1;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->set_sharding(static_cast<readout_sharding>(by));
+  return 0;
+}
+
+int readout_map_shard(readout_t * r_ptr, const uint8_t key, const int destination){
+  Readout * obj;
+  if (r_ptr == nullptr) return -1;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return obj->map_shard(key, destination);
+}
+
+int readout_set_output_queues(readout_t * r_ptr, const int policy, const int count){
+  Readout * obj;
+  if (r_ptr == nullptr) return -1;
+  if (policy < READOUT_QUEUE_SINGLE || policy > READOUT_QUEUE_ROUND_ROBIN) return -1;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return obj->set_output_queues(static_cast<readout_output_queues>(policy), count);
+}
+
+size_t readout_dropped_packets(readout_t * r_ptr){
+  Readout * obj;
+  if (r_ptr == nullptr) return 0;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return obj->dropped();
+}
+
+int readout_stats(readout_t * r_ptr, readout_stats_t * stats){
+  Readout * obj;
+  if (r_ptr == nullptr || stats == nullptr) return -1;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  *stats = obj->stats();
+  return 0;
+}
+
+void readout_print_stats(readout_t * r_ptr){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->print_stats();
+}
+
+void readout_enable_stage_timing(readout_t * r_ptr, const char * filename){
+  Readout * obj;
+  if (r_ptr == nullptr || filename == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->enable_stage_timing(filename);
+}
+
+void readout_disable_stage_timing(readout_t * r_ptr){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->enable_stage_timing("");
+}
+
+void readout_enable_multi_producer(readout_t * r_ptr){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->enable_multi_producer();
+}
+
+void readout_disable_multi_producer(readout_t * r_ptr){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->disable_multi_producer();
+}
+
+int readout_aggregate_shared(readout_t * r_ptr, const char * name, const int slots){
+  Readout * obj;
+  if (r_ptr == nullptr || name == nullptr) return -1;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return obj->aggregate_shared(name, slots > 0 ? static_cast<size_t>(slots) : 1u);
+}
+
+int readout_feed_shared(readout_t * r_ptr, const char * name){
+  Readout * obj;
+  if (r_ptr == nullptr || name == nullptr) return -1;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return obj->feed_shared(name);
+}
+
+void readout_get_pulse_reference(readout_t * r_ptr, uint32_t * pulse_high, uint32_t * pulse_low,
+                                 uint32_t * prev_pulse_high, uint32_t * prev_pulse_low){
+  Readout * obj;
+  if (r_ptr == nullptr || pulse_high == nullptr || pulse_low == nullptr) return;
+  if (prev_pulse_high == nullptr || prev_pulse_low == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  std::tie(*pulse_high, *pulse_low) = obj->lastPulseTime();
+  std::tie(*prev_pulse_high, *prev_pulse_low) = obj->prevPulseTime();
+}
+
+void readout_set_pulse_reference(readout_t * r_ptr, const uint32_t pulse_high, const uint32_t pulse_low,
+                                 const uint32_t prev_pulse_high, const uint32_t prev_pulse_low){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->set_pulse_reference(pulse_high, pulse_low, prev_pulse_high, prev_pulse_low);
+}
+
+void readout_set_sequence(readout_t * r_ptr, const uint32_t start, const uint32_t stride){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->set_sequence(start, stride);
+}
+
+pulse_clock_t * readout_clock_attach(const char * name, const double source_frequency){
+  if (name == nullptr || source_frequency <= 0) return nullptr;
+  std::lock_guard lock(registry_mutex);
+  if (auto found = clocks.find(name); found != clocks.end()) {
+    auto & attachment = found->second;
+    // the caller reports the mismatch, if it wants to
+    if (attachment.frequency != source_frequency) return nullptr;
+    ++attachment.count;
+    return attachment.c_ptr;
+  }
+  auto c_ptr = new pulse_clock_t{std::make_shared<PulseClock>(efu_time(1 / source_frequency))};
+  clocks.emplace(name, ClockAttachment{c_ptr, source_frequency, 1});
+  return c_ptr;
+}
+
+void readout_clock_detach(pulse_clock_t * c_ptr){
+  if (c_ptr == nullptr) return;
+  std::lock_guard lock(registry_mutex);
+  for (auto attachment = clocks.begin(); attachment != clocks.end(); ++attachment) {
+    if (attachment->second.c_ptr != c_ptr) continue;
+    // followers hold on to the clock itself
+    if (--attachment->second.count == 0) {
+      delete c_ptr;
+      clocks.erase(attachment);
+    }
+    return;
+  }
+}
+
+void readout_follow_clock(readout_t * r_ptr, pulse_clock_t * c_ptr){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->follow(c_ptr == nullptr ? nullptr : c_ptr->clock);
+}
+
+int readout_set_clock(readout_t * r_ptr, const int mode, const double value){
+  Readout * obj;
+  if (r_ptr == nullptr) return -1;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return obj->set_clock(static_cast<readout_clock>(mode), value);
+}
+
+int readout_next_pulse(readout_t * r_ptr){
+  Readout * obj;
+  if (r_ptr == nullptr) return -1;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return obj->next_simulated_pulse();
+}
+
+int readout_pulse_rolls_over(readout_t * r_ptr, const size_t pending){
+  Readout * obj;
+  if (r_ptr == nullptr) return -1;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return obj->pulse_rolls_over(pending) ? 1 : 0;
+}
+
+void readout_disable_batching(readout_t * r_ptr){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return obj->disable_batching();
+}
+void readout_enable_batching(readout_t * r_ptr){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  return obj->enable_batching();
+}
+
 void readout_rand_seed01(readout_t * r_ptr, const double seed){
   Readout * obj;
   if (r_ptr == nullptr) return;
@@ -148,6 +518,18 @@ void readout_rand_seed(readout_t * r_ptr, const uint32_t seed){
   obj = static_cast<Readout*>(r_ptr->obj);
   return obj->set_random_seed(seed);
 }
+void readout_rand_stream(readout_t * r_ptr, const uint32_t stream){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->set_random_stream(stream);
+}
+void readout_rand_event(readout_t * r_ptr, const uint64_t event){
+  Readout * obj;
+  if (r_ptr == nullptr) return;
+  obj = static_cast<Readout*>(r_ptr->obj);
+  obj->set_random_event(event);
+}
 int readout_rand_poisson(readout_t * r_ptr, const double mean){
   Readout * obj;
   if (r_ptr == nullptr) return 0;
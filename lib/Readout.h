@@ -18,6 +18,8 @@
 #define RL_API
 #endif
 
+#include "Structs.h"
+
 #ifdef __cplusplus
 extern "C" {
 #include <cstdint>
@@ -56,19 +58,153 @@ typedef struct TTLMonitor_readout TTLMonitor_readout_t;
 typedef struct DREAM_readout DREAM_readout_t;
 typedef struct VMM3_readout VMM3_readout_t;
 
+// Structure-of-arrays payloads for readout_add_batch, each pointer is to a column of `count` values.
+// A NULL column is treated as all zeros.
+struct CAEN_columns {
+  const uint8_t * channel;
+  const uint16_t * a;
+  const uint16_t * b;
+  const uint16_t * c;
+  const uint16_t * d;
+};
+
+struct TTLMonitor_columns {
+  const uint8_t * channel;
+  const uint8_t * pos;
+  const uint16_t * adc;
+};
+
+struct DREAM_columns {
+  const uint8_t * om;
+  const uint8_t * cathode;
+  const uint8_t * anode;
+};
+
+struct VMM3_columns {
+  const uint16_t * bc;
+  const uint16_t * otadc;
+  const uint8_t * geo;
+  const uint8_t * tdc;
+  const uint8_t * vmm;
+  const uint8_t * channel;
+};
+
+typedef struct CAEN_columns CAEN_columns_t;
+typedef struct TTLMonitor_columns TTLMonitor_columns_t;
+typedef struct DREAM_columns DREAM_columns_t;
+typedef struct VMM3_columns VMM3_columns_t;
+
 struct readout;
 typedef struct readout readout_t;
+struct pulse_clock;
+typedef struct pulse_clock pulse_clock_t;
+
+// Packet transmission backends, see readout_set_transport
+enum readout_transport {
+  READOUT_TRANSPORT_UDP = 0,       // one sendto system call per packet (default)
+  READOUT_TRANSPORT_SENDMMSG = 1,  // queue packets and send them with a single sendmmsg system call (Linux only)
+  READOUT_TRANSPORT_GSO = 2,       // concatenate packets and let the kernel split them with UDP_SEGMENT (Linux only)
+  READOUT_TRANSPORT_URING = 3,     // submit packets asynchronously through an io_uring of `batch` slots (Linux only)
+};
+
+// What to do with a packet when the sender thread ring is full, see readout_set_sender_thread
+enum readout_full_ring {
+  READOUT_FULL_RING_BLOCK = 0,  // wait for the sender thread to free a slot (default)
+  READOUT_FULL_RING_DROP = 1,   // discard the packet
+  READOUT_FULL_RING_GROW = 2,   // queue the packet in an unbounded overflow list
+};
+
+// Units of the transmission rate limit, see readout_set_pacing
+enum readout_pacing {
+  READOUT_PACING_NONE = 0,    // send packets as fast as possible (default)
+  READOUT_PACING_EVENTS = 1,  // limit the number of readouts sent per second
+  READOUT_PACING_BYTES = 2,   // limit the number of UDP payload bytes sent per second
+};
+
+// How readouts are routed to the destinations of a Readout object, see readout_set_sharding
+enum readout_sharding {
+  READOUT_SHARD_NONE = 0,  // send every readout to the first destination (default)
+  READOUT_SHARD_RING = 1,  // route each readout by its ring (fibre) number
+  READOUT_SHARD_FEN = 2,   // route each readout by its FEN number
+};
+
+// How packets are assigned to the output queues of the Event Formation Unit, see readout_set_output_queues
+enum readout_output_queues {
+  READOUT_QUEUE_SINGLE = 0,       // every packet is for queue 0 (default)
+  READOUT_QUEUE_RING = 1,         // the queue is the ring (fibre) number modulo the number of queues
+  READOUT_QUEUE_FEN = 2,          // the queue is the FEN number modulo the number of queues
+  READOUT_QUEUE_ROUND_ROBIN = 3,  // each full packet moves on to the next queue
+};
+
+// Where the pulse times come from, see readout_set_clock
+enum readout_clock {
+  READOUT_CLOCK_SYSTEM = 0,  // the system clock, read for every readout added (default)
+  READOUT_CLOCK_EVENTS = 1,  // a simulated clock, one pulse later every `value` events added
+  READOUT_CLOCK_MANUAL = 2,  // a simulated clock, one pulse later per call to readout_next_pulse
+  READOUT_CLOCK_RATE = 3,    // a simulated clock, 1 / `value` seconds later per event added, i.e., `value` events per second
+};
+
+// The number of bins of the send latency histogram, see readout_stats
+enum readout_latency_bins {READOUT_LATENCY_BINS = 16};
+
+// Counters kept by a Readout object since its creation, see readout_stats
+struct readout_stats {
+  uint64_t events;         // readouts added for sending, before Poisson expansion
+  uint64_t readouts;       // readouts packed, after Poisson expansion
+  uint64_t packets;        // packets handed to the transport backends
+  uint64_t bytes;          // UDP payload bytes of those packets
+  uint64_t send_errors;    // packets whose transport backend returned an error
+  uint64_t pulse_flushes;  // partly filled packets sent because the pulse time rolled over
+  uint64_t written_rows;   // readouts saved to file
+  uint64_t dropped;        // packets discarded because the sender thread ring was full
+  uint64_t abandoned;      // readouts discarded by a feeder because the aggregator stopped taking them
+  // packets by the time taken to hand them to the transport backend: bin 0 is below 1 us, bin i from 2^(i-1) us
+  // to 2^i us, and the last bin everything slower
+  uint64_t latency[READOUT_LATENCY_BINS];
+};
+typedef struct readout_stats readout_stats_t;
 
 // Create a new Readout object
 // type == 0x34 for BIFROST, 0x41 for He3CSPEC
 RL_API readout_t * readout_create(const char* address, int port, int command_port, double source_frequency, int type);
 
-// Destroy an existing Readout object
+// Attach to the Readout object registered under `name`, e.g., shared by every component sending to one EFU,
+// creating it with the remaining arguments if there is none. Every attachment is released by readout_destroy, and the
+// object is destroyed with the last. Returns NULL, without a message, if the registered object has a different
+// destination or type.
+RL_API readout_t * readout_attach(const char * name, const char* address, int port, int command_port, double source_frequency, int type);
+// The number of attachments to a registered Readout object, or 0 for one made by readout_create
+RL_API int readout_attachments(readout_t * r_ptr);
+
+// Destroy an existing Readout object, or release one attachment to a registered object
 RL_API void readout_destroy(readout_t* r_ptr);
 
 // Add a readout value to the transmission buffer of the Readout object
 // Automatically transmits the packet if it is full.
 RL_API void readout_add(readout_t* r_ptr, uint8_t ring, uint8_t fen, double time_of_flight, double weight, const void* data);
+// Typed variants of readout_add, which call straight into the packing for their payload type.
+// Returns 0, or -1 without adding the readout if the payload type does not match the Readout object type.
+RL_API int readout_add_caen(readout_t* r_ptr, uint8_t ring, uint8_t fen, double time_of_flight, double weight, const CAEN_readout_t* data);
+RL_API int readout_add_ttlmonitor(readout_t* r_ptr, uint8_t ring, uint8_t fen, double time_of_flight, double weight, const TTLMonitor_readout_t* data);
+RL_API int readout_add_dream(readout_t* r_ptr, uint8_t ring, uint8_t fen, double time_of_flight, double weight, const DREAM_readout_t* data);
+RL_API int readout_add_vmm3(readout_t* r_ptr, uint8_t ring, uint8_t fen, double time_of_flight, double weight, const VMM3_readout_t* data);
+// Add `count` readout values at once, with the per-readout values provided as parallel arrays and the payload
+// as the *_columns_t struct matching the Readout object type.
+// The pulse time is updated once for the whole batch.
+RL_API void readout_add_batch(readout_t* r_ptr, size_t count, const uint8_t* ring, const uint8_t* fen,
+                              const double* time_of_flight, const double* weight, const void* columns);
+
+// Reserve the next readout in the transmission buffer of the Readout object, sending the packet first if it is full.
+// The returned wire-format readout has its ring, FEN, length and time already set; the caller fills in the payload
+// and must then call readout_commit before the next reserve or add call.
+// NULL is returned if the requested readout kind does not match the Readout object type.
+RL_API struct CaenData * readout_reserve_caen(readout_t* r_ptr, uint8_t ring, uint8_t fen, double time_of_flight);
+RL_API struct TTLMonitorData * readout_reserve_ttlmonitor(readout_t* r_ptr, uint8_t ring, uint8_t fen, double time_of_flight);
+RL_API struct DreamData * readout_reserve_dream(readout_t* r_ptr, uint8_t ring, uint8_t fen, double time_of_flight);
+RL_API struct VMM3Data * readout_reserve_vmm3(readout_t* r_ptr, uint8_t ring, uint8_t fen, double time_of_flight);
+// Include the reserved readout in the packet; it is stored as a single (weight zero) event if file output is on
+RL_API void readout_commit(readout_t* r_ptr);
+
 // Send the current data buffer for the Readout object
 RL_API void readout_send(readout_t* r_ptr);
 // Update the pulse and previous pulse times for the Readout object
@@ -103,9 +239,144 @@ RL_API void readout_merge_files(const char * out_filename, const char ** in_file
 RL_API void readout_disable_network(readout_t * r_ptr);
 RL_API void readout_enable_network(readout_t * r_ptr);
 
+// Select the packet transmission backend for the Readout object.
+// Queueing backends send up to `batch` packets per system call, and also send their queue when the pulse time
+// rolls over if `flush_on_pulse` is non-zero; readout_send and readout_destroy always send all queued packets.
+// Returns the backend in use, which is READOUT_TRANSPORT_UDP if the requested one is unavailable, or -1 without
+// changing anything if `transport` is not a readout_transport value or `r_ptr` is NULL.
+RL_API int readout_set_transport(readout_t * r_ptr, int transport, int batch, int flush_on_pulse);
+
+// Send packets from a dedicated thread, fed through a ring of `depth` packet buffers, or inline if `depth` is 0.
+// `full_ring` is a readout_full_ring value; the ring is drained by readout_send and readout_destroy.
+// Returns 0, or -1 if `full_ring` is not a readout_full_ring value.
+RL_API int readout_set_sender_thread(readout_t * r_ptr, int depth, int full_ring);
+
+// Limit the transmission rate to `rate` readouts or bytes per second, depending on `unit` (a readout_pacing value),
+// allowing up to `burst` readouts or bytes to be sent back-to-back. A non-positive `rate` removes the limit.
+// Returns 0, or -1 if `unit` is not a readout_pacing value.
+RL_API int readout_set_pacing(readout_t * r_ptr, int unit, double rate, double burst);
+
+// The total time, in seconds, that packets have been held back by the transmission rate limit
+RL_API double readout_throttled_time(readout_t * r_ptr);
+
+// Emulate the source timing: hold the packets of each pulse back until `delay` seconds after the pulse time, then
+// release them together from a scheduler thread. A negative `delay` is replaced by one pulse period, the minimum
+// needed when pulse times follow the system clock since a pulse only ends once the next begins.
+RL_API void readout_enable_pulse_bursts(readout_t * r_ptr, double delay);
+RL_API void readout_disable_pulse_bursts(readout_t * r_ptr);
+
+// Set the options used when a destination is an IPv4 multicast group: the number of router hops `ttl`, the
+// IPv4 `interface_address` to send from (NULL or empty for the system default), and whether packets `loop` back
+// to group members on this host. Every group member receives the one packet sent.
+RL_API void readout_set_multicast(readout_t * r_ptr, int ttl, const char * interface_address, int loop);
+
+// The number of pulse bursts released more than a millisecond after their scheduled time
+RL_API size_t readout_missed_deadlines(readout_t * r_ptr);
+
+// Add a destination to the Readout object, with its own packet buffer, sequence counter and transport backend.
+// Returns the index of the destination, or -1 if no more can be added; the address given to readout_create is 0.
+RL_API int readout_add_destination(readout_t * r_ptr, const char * address, int port);
+// Select how readouts are routed to destinations, `by` is a readout_sharding value.
+// Returns 0, or -1 if it is not.
+RL_API int readout_set_sharding(readout_t * r_ptr, int by);
+// Send readouts whose ring or FEN number (depending on the sharding) is `key` to the indexed destination.
+// Readouts with an unmapped number go to destination 0. Returns 0, or -1 for an unknown destination.
+RL_API int readout_map_shard(readout_t * r_ptr, uint8_t key, int destination);
+
+// Spread packets over `count` (1 to 256) output queues of every destination, each with its own packet buffer and
+// sequence counter; `policy` is a readout_output_queues value. Returns 0, or -1 if `policy` is not a
+// readout_output_queues value or `count` is out of range.
+RL_API int readout_set_output_queues(readout_t * r_ptr, int policy, int count);
+
+// The number of packets discarded because the sender thread ring was full
+RL_API size_t readout_dropped_packets(readout_t * r_ptr);
+
+// Copy the counters of the Readout object to `stats`, e.g., to find out why an EFU sees fewer events than expected.
+// In multi-producer mode, call this while no thread is adding readouts. Returns 0, or -1 for a NULL pointer.
+RL_API int readout_stats(readout_t * r_ptr, readout_stats_t * stats);
+// Write the counters of the Readout object to standard output
+RL_API void readout_print_stats(readout_t * r_ptr);
+
+// Time the stages of adding readouts -- time conversion, Poisson sampling, packing, saving to file, and sending --
+// and write a JSON summary of the total, mean, percentile and maximum time per stage to `filename` when the object
+// is destroyed. Timing reads the clock a few times per readout, so is off by default.
+RL_API void readout_enable_stage_timing(readout_t * r_ptr, const char * filename);
+RL_API void readout_disable_stage_timing(readout_t * r_ptr);
+
+// Allow readout_add, readout_add_* and readout_add_batch to be called from several threads at once (off by default).
+// Each thread stages readouts in its own buffer, with its own random number generator seeded from the Readout seed,
+// and full buffers are assembled into packets with monotonic sequence numbers by one thread at a time.
+// All other calls, including readout_send and readout_destroy, must be made while no thread is adding readouts.
+// Reserving readouts in place is not possible in this mode, and pulse batching is always used.
+RL_API void readout_enable_multi_producer(readout_t * r_ptr);
+RL_API void readout_disable_multi_producer(readout_t * r_ptr);
+
+// Share one sender between the processes on a node, e.g., MPI ranks, through the named shared memory.
+// The aggregator creates the shared memory with room for `slots` staging buffers (each about 9 kB) and sends the
+// readouts of every feeder in one stream with its own; feeders attach to it and use the aggregator's pulse times.
+// Both enable multi-producer mode. Feeders must attach before adding readouts, and be destroyed before the
+// aggregator, which waits up to 10 s for them. A feeder which finds no free slot while the aggregator has not looked
+// for readouts for a second discards them, see readout_stats. Returns 0, or -1 if the shared memory could not be
+// created or found.
+RL_API int readout_aggregate_shared(readout_t * r_ptr, const char * name, int slots);
+RL_API int readout_feed_shared(readout_t * r_ptr, const char * name);
+
+// Keep several senders, e.g., MPI ranks which each send their own readouts, on one pulse timeline.
+// readout_get_pulse_reference gives the current pulse and previous pulse times of one Readout object, which every
+// other then takes over with readout_set_pulse_reference; their later pulses roll over at the same times, as long
+// as the system clocks of their hosts agree. Any readouts already packed are sent first.
+RL_API void readout_get_pulse_reference(readout_t * r_ptr, uint32_t * pulse_high, uint32_t * pulse_low,
+                                        uint32_t * prev_pulse_high, uint32_t * prev_pulse_low);
+RL_API void readout_set_pulse_reference(readout_t * r_ptr, uint32_t pulse_high, uint32_t pulse_low,
+                                        uint32_t prev_pulse_high, uint32_t prev_pulse_low);
+// Number the packets of every output queue `start`, `start + stride`, ... instead of 0, 1, ... so that several
+// senders to one destination use disjoint sequence numbers, e.g., the MPI rank and the number of ranks.
+// Meant to be called before any packet is sent.
+RL_API void readout_set_sequence(readout_t * r_ptr, uint32_t start, uint32_t stride);
+
+// Attach to the source pulse clock registered under `name`, creating it for a source with `source_frequency` if
+// there is none. The clock moves on once per pulse from a thread of its own, and every Readout object following it
+// (e.g., those of a detector and its monitors) uses the same pulse times without reading the system clock per readout.
+// Returns NULL, without a message, if the registered clock has a different frequency. Every attachment is released
+// by readout_clock_detach; Readout objects keep following the clock until they are destroyed or follow another.
+RL_API pulse_clock_t * readout_clock_attach(const char * name, double source_frequency);
+RL_API void readout_clock_detach(pulse_clock_t * c_ptr);
+// Take pulse times from the clock, or from the system clock again if `c_ptr` is NULL.
+// Pulse batching is always used while following a clock.
+RL_API void readout_follow_clock(readout_t * r_ptr, pulse_clock_t * c_ptr);
+
+// Move the pulse time on by simulated pulses instead of by the system clock, with `mode` a readout_clock value.
+// The system clock is then no longer read per readout, so readouts can be generated faster than real time, and
+// with readout_set_pulse_reference and readout_rand_seed the packets sent are the same from run to run. Events are
+// counted per readout_add, readout_add_* or readout_commit call and per row of readout_add_batch, whose rows are
+// stamped with one pulse time.
+// Pulse batching is always used with a simulated clock, and following a pulse clock stops.
+// Returns 0, or -1 for an unknown mode or, counting events, a `value` which is not positive.
+RL_API int readout_set_clock(readout_t * r_ptr, int mode, double value);
+// Move a simulated clock on by one pulse, sending the readouts of the previous pulse.
+// Returns 0, or -1 if the pulse time comes from the system clock or a pulse clock.
+RL_API int readout_next_pulse(readout_t * r_ptr);
+// Whether a readout added once `pending` more events have been added would be stamped with a later pulse time,
+// e.g., so that events collected for readout_add_batch are passed on before their pulse ends. Reads the system
+// clock unless the pulse times are simulated or follow a pulse clock. Returns 1 or 0, or -1 for a NULL pointer.
+RL_API int readout_pulse_rolls_over(readout_t * r_ptr, size_t pending);
+
+// Allow disabling and enabling pulse batching (on by default):
+// when enabled packets are only sent once full or when the pulse time rolls over,
+// when disabled every readout_add sends the current packet before adding its readout
+RL_API void readout_disable_batching(readout_t * r_ptr);
+RL_API void readout_enable_batching(readout_t * r_ptr);
+
 // Set the random seed for the readout random object
 RL_API void readout_rand_seed01(readout_t * r_ptr, double seed);
 RL_API void readout_rand_seed(readout_t * r_ptr, uint32_t seed);
+// Random numbers come from counter-based (Philox4x32-10) streams keyed by the seed and a stream number, 0 by default.
+// Give every MPI rank its own stream to draw independent, reproducible numbers; threads in multi-producer mode
+// each draw from a substream of their own.
+RL_API void readout_rand_stream(readout_t * r_ptr, uint32_t stream);
+// Restart the random numbers of the calling thread at those for one event, e.g., the McStas ray number, so that
+// the multiplicities drawn for it do not depend on which thread handles it or what was drawn before
+RL_API void readout_rand_event(readout_t * r_ptr, uint64_t event);
 // Convert a probability to a discrete number of events
 RL_API int readout_rand_poisson(readout_t * r_ptr, double mean);
 
@@ -6,11 +6,17 @@
 ///
 //===----------------------------------------------------------------------===//
 #include "ReadoutClass.h"
+#include "columns.h"
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <tuple>
 
 void Readout::setPulseTime(const uint32_t PHI, const uint32_t PLO, const uint32_t PPHI, const uint32_t PPLO) {
@@ -27,161 +33,759 @@ std::pair<uint32_t, uint32_t> Readout::prevPulseTime() const {
   return std::make_pair(pphi, pplo);
 }
 std::pair<uint32_t, uint32_t> Readout::lastEventTime() const {
-  return std::make_pair(lasthi, lastlo);
+  if (!multi_producer) return std::make_pair(lasthi, lastlo);
+  auto latest = efu_time(lasthi, lastlo).total_ticks();
+  std::lock_guard lock(producers_mutex);
+  for (const auto & staging: producers) latest = std::max(latest, staging->last_event.load(std::memory_order_relaxed));
+  return std::make_pair(static_cast<uint32_t>(latest / efu_time::ticks), static_cast<uint32_t>(latest % efu_time::ticks));
 }
 
 void Readout::newPacket() {
-  memset(buffer, 0x00, sizeof(buffer));
+  for (auto & stream: streams) for (auto & queue: stream.queues) newPacket(queue);
+}
+
+void Readout::newPacket(PacketQueue & queue) {
+  // every header field is written below, and readouts write every one of their fields, so no memset is needed
+  if (!queue.packet) queue.packet = pool.acquire();
+  queue.buffer = queue.packet->data;
+  auto * hp = queue.hp = reinterpret_cast<PacketHeaderV0 *>(queue.buffer);
   hp->Padding0 = 0;
   hp->Version = 0;
   hp->CookieAndType = (Type << 24) + 0x535345;
-  hp->OutputQueue = OutputQueue;
+  hp->OutputQueue = queue.OutputQueue;
   hp->TotalLength = sizeof(struct PacketHeaderV0);
-  hp->SeqNum = SeqNum++;
+  hp->SeqNum = queue.SeqNum;
+  queue.SeqNum += sequence_stride;
   hp->TimeSource = 0;
   hp->PulseHigh = phi;
   hp->PulseLow = plo;
   hp->PrevPulseHigh = pphi;
   hp->PrevPulseLow = pplo;
-  DataSize = sizeof(struct PacketHeaderV0);
-}
-
-void Readout::check_size_and_send() {
-  if (DataSize >= MaxDataSize) {
-    send();
-    newPacket();
-  }
-}
-
-void Readout::addReadout(const uint8_t Ring, const uint8_t FEN, const efu_time t, const CAEN_readout_t *data) {
-  check_size_and_send();
-  if (verbosity > 2){
-    std::cout << "Add to the packet Ring=" << static_cast<unsigned>(Ring) << " FEN=" << static_cast<unsigned>(FEN);
-    std::cout << " TimeHigh=" << t.high() << " TimeLow=" << t.low() << " Tube=" << static_cast<unsigned>(data->channel);
-    std::cout << " AmplA=" << data->a << " AmplB=" << data->b << std::endl;
-  }
-  auto *dp = (struct CaenData *)(buffer + DataSize);
-  dp->Ring = Ring;
-  dp->FEN = FEN;
-  dp->Length = sizeof(struct CaenData);
-  dp->TimeHigh = t.high();
-  dp->TimeLow = t.low();
-  dp->Tube = data->channel;
-  dp->AmplA = data->a;
-  dp->AmplB = data->b;
-  dp->AmplC = data->c;
-  dp->AmplD = data->d;
-  DataSize += dp->Length;
-  hp->TotalLength = DataSize;
-}
-
-void Readout::addReadout(const uint8_t Ring, const uint8_t FEN, const efu_time t, const TTLMonitor_readout_t *data) {
-  if (verbosity > 2){
-    std::cout << "Add to the packet Ring=" << static_cast<unsigned>(Ring) << " FEN=" << static_cast<unsigned>(FEN);
-    std::cout << " TimeHigh=" << t.high() << " TimeLow=" << t.low() << " Pos=" << static_cast<unsigned>(data->pos);
-    std::cout << " Channel=" << static_cast<unsigned>(data->channel) << " ADC=" << data->adc << std::endl;
-  }
-  check_size_and_send();
-  auto *dp = (struct TTLMonitorData *)(buffer + DataSize);
-  dp->Ring = Ring;
-  dp->FEN = FEN;
-  dp->Length = sizeof(struct TTLMonitorData);
-  dp->TimeHigh = t.high();
-  dp->TimeLow = t.low();
-  dp->Pos = data->pos;
-  dp->Channel = data->channel;
-  dp->ADC = data->adc;
-  DataSize += dp->Length;
-  hp->TotalLength = DataSize;
-}
-
-void Readout::addReadout(const uint8_t Ring, const uint8_t FEN, const efu_time t, const DREAM_readout_t *data) {
-  check_size_and_send();
-  auto *dp = (struct DreamData *)(buffer + DataSize);
-  dp->Ring = Ring;
-  dp->FEN = FEN;
-  dp->Length = sizeof(struct DreamData);
-  dp->TimeHigh = t.high();
-  dp->TimeLow = t.low();
-  dp->OM = data->om;
-  dp->Cathode = data->cathode;
-  dp->Anode = data->anode;
-  DataSize += dp->Length;
-  hp->TotalLength = DataSize;
-}
-
-void Readout::addReadout(const uint8_t Ring, const uint8_t FEN, const efu_time t, const VMM3_readout_t *data) {
-  check_size_and_send();
-  auto *dp = (struct VMM3Data *)(buffer + DataSize);
-  dp->Ring = Ring;
-  dp->FEN = FEN;
-  dp->Length = sizeof(struct VMM3Data);
-  dp->TimeHigh = t.high();
-  dp->TimeLow = t.low();
-  dp->BC = data->bc;
-  dp->OTADC = data->otadc;
-  dp->GEO = data->geo;
-  dp->TDC = data->tdc;
-  dp->VMM = data->vmm;
-  dp->Channel = data->channel;
-  DataSize += dp->Length;
-  hp->TotalLength = DataSize;
+  queue.DataSize = sizeof(struct PacketHeaderV0);
+}
+
+void Readout::stampPulseTime(PacketQueue & queue) {
+  queue.hp->PulseHigh = phi;
+  queue.hp->PulseLow = plo;
+  queue.hp->PrevPulseHigh = pphi;
+  queue.hp->PrevPulseLow = pplo;
 }
 
+PacketQueue & Readout::queue_for(PacketStream & stream, const uint8_t Ring, const uint8_t FEN) {
+  const auto count = stream.queues.size();
+  auto & queue = [&]() -> PacketQueue & {
+    switch (queue_policy) {
+      case READOUT_QUEUE_RING: return stream.queues[Ring % count];
+      case READOUT_QUEUE_FEN: return stream.queues[FEN % count];
+      case READOUT_QUEUE_ROUND_ROBIN: return stream.queues[stream.next];
+      default: return stream.queues.front();
+    }
+  }();
+  if (queue.DataSize < MaxDataSize) return queue;
+  // send() starts the next packet
+  send(stream, queue);
+  if (queue_policy != READOUT_QUEUE_ROUND_ROBIN) return queue;
+  // only the queue being filled holds readouts, so the next one is empty
+  stream.next = (stream.next + 1) % count;
+  return stream.queues[stream.next];
+}
 
 void Readout::addReadout(const uint8_t Ring, const uint8_t FEN, const double tof, const double weight, const void *data) {
-  // store the readout to file if requested
-  if (writer.has_value()) writer->saveReadout(Ring, FEN, tof, weight, data);
+  // the payload type is only known at run time via the void pointer interface
+  switch (Readout_type) {
+    case ReadoutType::CAEN: add(Ring, FEN, tof, weight, *static_cast<const CAEN_readout_t*>(data)); return;
+    case ReadoutType::TTLMonitor: add(Ring, FEN, tof, weight, *static_cast<const TTLMonitor_readout_t*>(data)); return;
+    case ReadoutType::DREAM: add(Ring, FEN, tof, weight, *static_cast<const DREAM_readout_t*>(data)); return;
+    case ReadoutType::VMM3: add(Ring, FEN, tof, weight, *static_cast<const VMM3_readout_t*>(data)); return;
+    default: throw std::runtime_error("This readout data type not implemented yet!");
+  }
+}
+
+
+template<class Payload>
+void Readout::packReadouts(const size_t count, const uint8_t *Ring, const uint8_t *FEN, const double *tof, const double *weight, const typename payload_traits<Payload>::columns *columns) {
+  if (multi_producer) return stageReadouts<Payload>(count, Ring, FEN, tof, weight, columns);
+  // multiplicities are timed per chunk, the time and packing per readout
+  StageLaps laps(stage_times());
+  int multiplicity[PoissonSampler::Chunk];
+  for (size_t first=0; first<count; first += PoissonSampler::Chunk){
+    const auto n = std::min(PoissonSampler::Chunk, count - first);
+    if (weight) PoissonSampler::sample(random_engine, n, weight + first, multiplicity);
+    laps(Stage::poisson);
+    for (size_t i=first; i<first + n; ++i){
+      const auto t = efu_time(column_value(tof, i)) + time;
+      laps(Stage::time);
+      const auto payload = readout_row(columns, i);
+      // weighted events are repeated a Poisson-distributed number of times, noise events (w == 0) are sent once
+      const int repeats = column_value(weight, i) ? multiplicity[i - first] : 1;
+      for (int j=0; j<repeats; ++j) packReadout(column_value(Ring, i), column_value(FEN, i), t, payload);
+      counters.readouts += repeats;
+      lasthi = t.high();
+      lastlo = t.low();
+      laps(Stage::pack);
+    }
+  }
+  counters.events += count;
+  count_simulated(count);
+}
+
+template<class Payload>
+void Readout::stageReadouts(const size_t count, const uint8_t *Ring, const uint8_t *FEN, const double *tof, const double *weight, const typename payload_traits<Payload>::columns *columns) {
+  auto & staging = producer();
+  refresh(staging);
+  StageLaps laps(stage_times());
+  int multiplicity[PoissonSampler::Chunk];
+  for (size_t first=0; first<count; first += PoissonSampler::Chunk){
+    const auto n = std::min(PoissonSampler::Chunk, count - first);
+    if (weight) PoissonSampler::sample(staging.random_engine, n, weight + first, multiplicity);
+    laps(Stage::poisson);
+    for (size_t i=first; i<first + n; ++i){
+      const auto t = efu_time(column_value(tof, i)) + staging.pulse.time;
+      laps(Stage::time);
+      const auto payload = readout_row(columns, i);
+      const int repeats = column_value(weight, i) ? multiplicity[i - first] : 1;
+      for (int j=0; j<repeats; ++j) stageReadout(staging, column_value(Ring, i), column_value(FEN, i), t, payload);
+      staging.readouts += repeats;
+      staging.last_event.store(t.total_ticks(), std::memory_order_relaxed);
+      laps(Stage::pack);
+    }
+  }
+  staging.events += count;
+  count_simulated(count);
+}
+
+void Readout::addReadouts(const size_t count, const uint8_t *Ring, const uint8_t *FEN, const double *tof, const double *weight, const void *columns) {
+  if (count == 0 || columns == nullptr) return;
+  if (writer.has_value()) {
+    StageLaps laps(stage_times());
+    std::lock_guard lock(writer_mutex);
+    writer->saveReadouts(count, Ring, FEN, tof, weight, columns);
+    counters.written_rows += count;
+    laps(Stage::write);
+  }
   if (!network){
-    if (verbosity > 1) std::cout << "No readout added to buffer due to disabled network" << std::endl;
+    if (logs<2>()) LogSink::instance().write("No readouts added to buffer due to disabled network");
     return;
   }
-  // provided time-of-flight plus the current pulse time
-  auto t = efu_time(tof) + time;
-  // TODO implement t = (tof % period) + time -- such that we have realistic reference times
-  lasthi = t.high();
-  lastlo = t.low();
-  // send the same event (possibly) multiple times, depending on the weighted counting rate
-  if (weight) {
-    for (int i = 0; i < random_poisson(weight); ++i) addReadout(Ring, FEN, t, data);
-  } else {
-    // this is a noise event, which has randomized data and should always be sent
-    addReadout(Ring, FEN, t, data);
+  switch (Readout_type) {
+    case ReadoutType::CAEN: return packReadouts<CAEN_readout_t>(count, Ring, FEN, tof, weight, static_cast<const CAEN_columns_t*>(columns));
+    case ReadoutType::TTLMonitor: return packReadouts<TTLMonitor_readout_t>(count, Ring, FEN, tof, weight, static_cast<const TTLMonitor_columns_t*>(columns));
+    case ReadoutType::DREAM: return packReadouts<DREAM_readout_t>(count, Ring, FEN, tof, weight, static_cast<const DREAM_columns_t*>(columns));
+    case ReadoutType::VMM3: return packReadouts<VMM3_readout_t>(count, Ring, FEN, tof, weight, static_cast<const VMM3_columns_t*>(columns));
+    default: throw std::runtime_error("This readout data type not implemented yet!");
   }
 }
 
 
-void Readout::addReadout(const uint8_t Ring, const uint8_t FEN, const efu_time t, const void *data){
-  const auto type = readoutType_from_detectorType(Type);
-  switch (type) {
-    case ReadoutType::CAEN: return addReadout(Ring, FEN, t, static_cast<const CAEN_readout_t*>(data));
-    case ReadoutType::TTLMonitor: return addReadout(Ring, FEN, t, static_cast<const TTLMonitor_readout_t*>(data));
-    case ReadoutType::DREAM: return addReadout(Ring, FEN, t, static_cast<const DREAM_readout_t*>(data));
-    case ReadoutType::VMM3: return addReadout(Ring, FEN, t, static_cast<const VMM3_readout_t*>(data));
-    default: throw std::runtime_error("This readout data type not implemented yet!");
+template<class Payload> void Readout::saveReserved() {
+  const auto & queue = streams[ReservedStream].queues[ReservedQueue];
+  const auto &d = *reinterpret_cast<const typename payload_traits<Payload>::wire *>(queue.buffer + queue.DataSize);
+  writer->saveReadout(d.Ring, d.FEN, ReservedTof, 0., payload_traits<Payload>::unpack(d));
+}
+
+void Readout::commitReadout() {
+  if (!Reserved) return;
+  if (writer.has_value()) {
+    switch (Readout_type) {
+      case ReadoutType::CAEN: saveReserved<CAEN_readout_t>(); break;
+      case ReadoutType::TTLMonitor: saveReserved<TTLMonitor_readout_t>(); break;
+      case ReadoutType::DREAM: saveReserved<DREAM_readout_t>(); break;
+      case ReadoutType::VMM3: saveReserved<VMM3_readout_t>(); break;
+      default: throw std::runtime_error("This readout data type not implemented yet!");
+    }
+    ++counters.written_rows;
   }
+  if (network) {
+    auto & queue = streams[ReservedStream].queues[ReservedQueue];
+    queue.DataSize += Reserved;
+    queue.hp->TotalLength = queue.DataSize;
+    ++counters.events;
+    ++counters.readouts;
+    count_simulated(1);
+  } else if (logs<2>()) {
+    LogSink::instance().write("No readout added to buffer due to disabled network");
+  }
+  Reserved = 0;
 }
 
 
 void Readout::dump_to(const std::string & filename, const std::string & dataset_name){
-  writer = Writer(filename, Type, readoutType_from_detectorType(Type), dataset_name);
+  std::lock_guard lock(writer_mutex);
+  writer = Writer(filename, Type, Readout_type, dataset_name);
 }
 
 
 int Readout::send() {
+  if (aggregating) while (gather()) {}
+  if (multi_producer) {
+    std::lock_guard lock(assembler);
+    collect();
+    return send_streams();
+  }
+  return send_streams();
+}
+
+int Readout::send_pending() {
+  if (aggregating) while (gather()) {}
+  if (multi_producer) {
+    std::lock_guard lock(assembler);
+    collect();
+    return send_streams(true);
+  }
+  return send_streams(true);
+}
+
+int Readout::send_streams(const bool pending_only) {
+  int error_code{0};
+  for (auto & stream: streams) for (auto & queue: stream.queues) {
+    if (pending_only && !queue.has_data()) continue;
+    if (auto error = send(stream, queue)) error_code = error;
+  }
+  return error_code;
+}
+
+int Readout::send(PacketStream & stream, PacketQueue & queue) {
   if (!network){
-    if (verbosity > 1) std::cout << "No packet sent due to disabled network" << std::endl;
+    if (logs<2>()) LogSink::instance().write("No packet sent due to disabled network");
     return 0;
   }
-  auto chr_ptr = reinterpret_cast<char *>(buffer);
-  auto [bytes, error_code] = sender.send(std::string(chr_ptr, chr_ptr + DataSize));
-  if (error_code < 0 && verbosity > -1){
-    std::cout << "Sending UDP data failed: returns " << error_code << "\n";
+  const auto bytes = queue.packet->size = static_cast<size_t>(queue.DataSize);
+  const auto start = std::chrono::steady_clock::now();
+  auto error_code = stream.transport->send(std::move(queue.packet));
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  count_packet(bytes, error_code, elapsed);
+  // sending happens under the assembler lock in multi-producer mode, so always records to the object's own timing;
+  // a send while packing is not counted as packing too
+  if (timing) {
+    timing->record(Stage::send, elapsed);
+    StageLaps::exclude(elapsed);
   }
-  newPacket();
+  if (error_code && logs<0>()){
+    LogSink::instance().write("Sending UDP data to " + stream.ipaddr + ":" + std::to_string(stream.port) + " failed: returns " + std::to_string(error_code));
+  }
+  newPacket(queue);
   return error_code;
 }
 
+void Readout::count_packet(const size_t bytes, const int error_code, const std::chrono::nanoseconds elapsed) {
+  ++counters.packets;
+  counters.bytes += bytes;
+  if (error_code) ++counters.send_errors;
+  const auto us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+  ++counters.latency[std::min<size_t>(std::bit_width(us), READOUT_LATENCY_BINS - 1)];
+}
+
+readout_stats_t Readout::stats() {
+  // the aggregator's collector thread may be sending
+  std::unique_lock lock(assembler, std::defer_lock);
+  if (multi_producer) lock.lock();
+  auto result = counters;
+  {
+    std::lock_guard producers_lock(producers_mutex);
+    for (const auto & staging: producers) {
+      result.events += staging->events;
+      result.readouts += staging->readouts;
+    }
+  }
+  result.dropped = dropped();
+  result.abandoned = abandoned.load(std::memory_order_relaxed);
+  return result;
+}
+
+void Readout::enable_stage_timing(const std::string & filename) {
+  // an aggregator's collector thread records send times under the assembler lock
+  std::unique_lock lock(assembler, std::defer_lock);
+  if (multi_producer) lock.lock();
+  timing_file = filename;
+  if (!filename.empty()) {
+    if (!timing) timing = std::make_unique<StageTimes>();
+    return;
+  }
+  timing.reset();
+  std::lock_guard producers_lock(producers_mutex);
+  for (auto & staging: producers) staging->times.reset();
+}
+
+int Readout::write_stage_timing(const std::string & filename) {
+  if (!timing) return -1;
+  auto times = *timing;
+  {
+    std::lock_guard lock(producers_mutex);
+    for (const auto & staging: producers) if (staging->times) times += *staging->times;
+  }
+  std::ofstream out(filename);
+  if (!out) return -1;
+  times.write_json(out);
+  return out ? 0 : -1;
+}
+
+void Readout::print_stats() {
+  const auto s = stats();
+  LogSink::instance().flush();
+  std::cout << "Readout to " << ipaddr << ":" << port << ": " << s.events << " events added, " << s.readouts << " readouts, ";
+  std::cout << s.packets << " packets (" << s.bytes << " bytes), " << s.send_errors << " send errors, ";
+  std::cout << s.pulse_flushes << " partial packets at pulse rollover, " << s.dropped << " dropped, ";
+  std::cout << s.abandoned << " readouts abandoned, " << s.written_rows << " rows written\n";
+  std::cout << "Send latency (packets below 1, 2, 4, ... us):";
+  for (const auto count: s.latency) std::cout << " " << count;
+  std::cout << "\n";
+}
+
+int Readout::flush() {
+  if (multi_producer) {
+    std::lock_guard lock(assembler);
+    return flush_streams();
+  }
+  return flush_streams();
+}
+
+int Readout::flush_streams() {
+  int error_code{0};
+  for (auto & stream: streams) {
+    auto error = stream.transport->flush();
+    if (error && logs<0>()){
+      LogSink::instance().write("Sending queued UDP data to " + stream.ipaddr + ":" + std::to_string(stream.port) + " failed: returns " + std::to_string(error));
+    }
+    if (error) error_code = error;
+  }
+  return error_code;
+}
+
+int Readout::set_transport(const readout_transport type, const size_t batch, const bool flush_pulse) {
+  flush();
+  // release the old backends, and any sender threads, before opening new sockets
+  for (auto & stream: streams) stream.transport.reset();
+  transport_type = type;
+  transport_batch = batch;
+  flush_on_pulse = flush_pulse;
+  size_t capacity{0};
+  for (auto & stream: streams) {
+    stream.transport = build_transport(stream);
+    capacity += stream.transport->capacity() + stream.queues.size();
+  }
+  // so that, once running, sending never allocates
+  pool.reserve(capacity);
+  return streams.front().transport->type();
+}
+
+std::unique_ptr<Transport> Readout::build_transport(const PacketStream & stream) {
+  auto transport = make_transport(transport_type, stream.ipaddr, static_cast<uint16_t>(stream.port), transport_batch);
+  if (transport->type() != transport_type && verbosity > 0){
+    std::cout << "Requested packet transport " << transport_type << " is not available, using one UDP send per packet\n";
+  }
+  if (multicast.has_value()) {
+    auto error_code = transport->set_multicast(multicast.value());
+    if (error_code && verbosity > -1){
+      std::cout << "Setting multicast options for " << stream.ipaddr << " failed: returns " << error_code << "\n";
+    }
+  }
+  if (pacing != READOUT_PACING_NONE) {
+    transport = std::make_unique<PacedTransport>(std::move(transport), pacing, pacing_rate, pacing_burst, readout_size());
+  }
+  if (burst_delay.has_value()) {
+    transport = std::make_unique<PulseBurstTransport>(std::move(transport), burst_delay.value());
+  }
+  // the sender thread, if any, does the pacing and scheduling
+  if (sender_depth) {
+    transport = std::make_unique<ThreadedTransport>(std::move(transport), sender_depth, sender_full_ring);
+  }
+  return transport;
+}
+
+int Readout::add_destination(const std::string & IpAddress, const int UDPPort) {
+  // destinations are indexed by a byte in the routing table
+  if (streams.size() >= shard_of.size()) {
+    if (verbosity > -1) std::cout << "No more than " << shard_of.size() << " destinations can be used\n";
+    return -1;
+  }
+  auto & stream = streams.emplace_back(IpAddress, UDPPort);
+  stream.transport = build_transport(stream);
+  stream.queues.front().SeqNum = sequence_start;
+  newPacket(stream.queues.front());
+  // every destination has the same output queues
+  resize_queues(stream, streams.front().queues.size());
+  pool.reserve(pool.size() + stream.transport->capacity() + stream.queues.size());
+  return static_cast<int>(streams.size() - 1);
+}
+
+void Readout::resize_queues(PacketStream & stream, const size_t count) {
+  // queues which are kept keep their sequence counters
+  while (stream.queues.size() > count) stream.queues.pop_back();
+  while (stream.queues.size() < count) {
+    auto & queue = stream.queues.emplace_back(static_cast<uint8_t>(stream.queues.size()));
+    queue.SeqNum = sequence_start;
+    newPacket(queue);
+  }
+  stream.next = 0;
+}
+
+int Readout::set_output_queues(const readout_output_queues policy, const int count) {
+  // the queue number is a byte in the packet header
+  if (count < 1 || count > 256) {
+    if (verbosity > -1) std::cout << "Can not use " << count << " output queues\n";
+    return -1;
+  }
+  // readouts already in a packet are sent before their queue might disappear
+  for (auto & stream: streams) {
+    for (auto & queue: stream.queues) if (queue.has_data()) send(stream, queue);
+    resize_queues(stream, static_cast<size_t>(count));
+  }
+  queue_policy = policy;
+  size_t capacity{0};
+  for (const auto & stream: streams) capacity += stream.transport->capacity() + stream.queues.size();
+  pool.reserve(capacity);
+  return 0;
+}
+
+void Readout::set_pulse_reference(const uint32_t PHI, const uint32_t PLO, const uint32_t PPHI, const uint32_t PPLO) {
+  std::unique_lock lock(assembler, std::defer_lock);
+  if (multi_producer) {
+    lock.lock();
+    collect();
+  }
+  // readouts already packed are relative to the old pulse time
+  for (auto & stream: streams) for (auto & queue: stream.queues) if (queue.has_data()) send(stream, queue);
+  time = efu_time(PHI, PLO);
+  setPulseTime(PHI, PLO, PPHI, PPLO);
+  for (auto & stream: streams) for (auto & queue: stream.queues) stampPulseTime(queue);
+  if (multi_producer) publish_pulse();
+}
+
+void Readout::follow(std::shared_ptr<PulseClock> pulse_clock) {
+  {
+    std::unique_lock lock(assembler, std::defer_lock);
+    if (multi_producer) {
+      lock.lock();
+      collect();
+    }
+    clock = std::move(pulse_clock);
+    if (!clock) return;
+    clock_mode = READOUT_CLOCK_SYSTEM;
+    counting_events = false;
+    period = clock->period();
+    // the clock's current pulse times are taken below, whatever their generation
+    clock_generation = clock->generation() - 1;
+  }
+  update_time();
+}
+
+int Readout::set_clock(const readout_clock mode, const double value) {
+  switch (mode) {
+    case READOUT_CLOCK_SYSTEM: case READOUT_CLOCK_MANUAL: break;
+    case READOUT_CLOCK_EVENTS: case READOUT_CLOCK_RATE: if (value > 0) break; [[fallthrough]];
+    default: return -1;
+  }
+  std::unique_lock lock(assembler, std::defer_lock);
+  if (multi_producer) {
+    lock.lock();
+    collect();
+  }
+  // a simulated clock replaces any followed clock
+  if (mode != READOUT_CLOCK_SYSTEM) clock.reset();
+  clock_mode = mode;
+  counting_events = mode == READOUT_CLOCK_EVENTS || mode == READOUT_CLOCK_RATE;
+  // at `value` events per second, a pulse period holds value * period events
+  const auto period_seconds = static_cast<double>(period.total_ticks()) / static_cast<double>(efu_time::ticks);
+  events_per_pulse = mode == READOUT_CLOCK_RATE ? value * period_seconds : value;
+  simulated_start = simulated_events.load(std::memory_order_relaxed);
+  simulated_pulses = 0;
+  next_pulse_event = pulse_event(1);
+  return 0;
+}
+
+int Readout::next_simulated_pulse() {
+  // feeders follow the pulse times of their aggregator
+  if (clock || clock_mode == READOUT_CLOCK_SYSTEM || feeding()) return -1;
+  std::unique_lock lock(assembler, std::defer_lock);
+  if (multi_producer) {
+    lock.lock();
+    drain();
+  }
+  advance_pulses(1);
+  return 0;
+}
+
+bool Readout::pulse_rolls_over(const uint64_t pending) {
+  if (clock) return clock->generation() != clock_generation.load(std::memory_order_relaxed);
+  if (clock_mode == READOUT_CLOCK_MANUAL) return false;
+  if (counting_events) {
+    return simulated_events.load(std::memory_order_relaxed) + pending >= next_pulse_event.load(std::memory_order_relaxed);
+  }
+  if (multi_producer) {
+    // this thread's readouts are stamped with the pulse times it last took over
+    const auto & staging = producer();
+    const auto generation = feeding() ? shared->generation() : pulse_generation.load(std::memory_order_acquire);
+    if (generation != staging.generation) return true;
+    // feeders follow the pulse times of their aggregator
+    return !feeding() && efu_time().total_ticks() >= next_pulse.load(std::memory_order_relaxed);
+  }
+  return efu_time().total_ticks() >= (time + period).total_ticks();
+}
+
+void Readout::set_sequence(const uint32_t start, const uint32_t stride) {
+  std::unique_lock lock(assembler, std::defer_lock);
+  if (multi_producer) {
+    lock.lock();
+    collect();
+  }
+  sequence_start = start;
+  sequence_stride = std::max(stride, 1u);
+  // the packet under construction is renumbered too, so readouts already in it are kept
+  for (auto & stream: streams) for (auto & queue: stream.queues) {
+    queue.hp->SeqNum = sequence_start;
+    queue.SeqNum = sequence_start + sequence_stride;
+  }
+}
+
+int Readout::map_shard(const uint8_t key, const int destination) {
+  if (destination < 0 || static_cast<size_t>(destination) >= streams.size()) {
+    if (verbosity > -1) std::cout << "Can not route to unknown destination " << destination << "\n";
+    return -1;
+  }
+  shard_of[key] = static_cast<uint8_t>(destination);
+  return 0;
+}
+
+void Readout::set_pacing(const readout_pacing unit, const double rate, const double burst) {
+  pacing = unit;
+  pacing_rate = rate;
+  pacing_burst = burst;
+  set_transport(transport_type, transport_batch, flush_on_pulse);
+}
+
+void Readout::enable_pulse_bursts(const std::chrono::nanoseconds delay) {
+  burst_delay = delay;
+  set_transport(transport_type, transport_batch, flush_on_pulse);
+}
+
+void Readout::disable_pulse_bursts() {
+  burst_delay = std::nullopt;
+  set_transport(transport_type, transport_batch, flush_on_pulse);
+}
+
+void Readout::set_multicast(const MulticastOptions & options) {
+  multicast = options;
+  set_transport(transport_type, transport_batch, flush_on_pulse);
+}
+
+void Readout::set_sender_thread(const size_t depth, const readout_full_ring full_ring) {
+  sender_depth = depth;
+  sender_full_ring = full_ring;
+  set_transport(transport_type, transport_batch, flush_on_pulse);
+}
+
+void Readout::enable_multi_producer() {
+  if (multi_producer) return;
+  // enough room for every thread to queue a few staging buffers while another thread assembles
+  if (!staged) staged = std::make_unique<PacketMPSC>(4 * std::max(4u, std::thread::hardware_concurrency()));
+  publish_pulse();
+  multi_producer = true;
+}
+
+void Readout::disable_multi_producer() {
+  // sharing through shared memory relies on the staging buffers
+  if (!multi_producer || shared) return;
+  collect();
+  multi_producer = false;
+}
+
+void Readout::set_random_seed(const uint32_t seed) {
+  random_seed = seed;
+  random_engine.seed(seed);
+  std::lock_guard lock(producers_mutex);
+  for (auto & staging: producers) staging->random_engine.seed(seed);
+}
+
+void Readout::set_random_stream(const uint32_t stream) {
+  random_stream = stream;
+  random_engine.set_stream(stream);
+  std::lock_guard lock(producers_mutex);
+  for (auto & staging: producers) staging->random_engine.set_stream(stream);
+}
+
+Producer & Readout::producer() {
+  // threads usually feed only a few Readout objects, so a few remembered ones are quick to search; instance
+  // numbers are never reused, so entries for destroyed objects are never matched, only replaced
+  thread_local std::array<std::pair<uint64_t, Producer *>, ProducerCache> known{};
+  thread_local size_t replace{0};
+  for (const auto & [id, staging]: known) if (staging && id == instance) return *staging;
+  std::lock_guard lock(producers_mutex);
+  // the state of a thread whose entry was replaced, or which feeds many objects, is found by its owner
+  const auto thread = std::this_thread::get_id();
+  auto found = std::find_if(producers.begin(), producers.end(), [thread](const auto & staging){return staging->owner == thread;});
+  if (found == producers.end()) {
+    found = producers.insert(producers.end(), std::make_unique<Producer>());
+    // every thread draws from its own substream, 0 being that of the Readout object itself
+    (*found)->random_engine = Philox4x32(random_seed, random_stream, static_cast<uint32_t>(producers.size()));
+  }
+  known[replace++ % ProducerCache] = {instance, found->get()};
+  return **found;
+}
+
+void Readout::start_staging(Producer & staging) {
+  staging.staging = pool.acquire();
+  auto * header = reinterpret_cast<PacketHeaderV0 *>(staging.staging->data);
+  header->PulseHigh = staging.pulse.high;
+  header->PulseLow = staging.pulse.low;
+  header->PrevPulseHigh = staging.pulse.prev_high;
+  header->PrevPulseLow = staging.pulse.prev_low;
+  staging.staging->size = sizeof(PacketHeaderV0);
+}
+
+void Readout::push_staging(Producer & staging) {
+  if (feeding()) {
+    // the aggregator empties slots from its collector thread, unless it has stopped
+    using namespace std::chrono;
+    auto beat = shared->heartbeat();
+    auto beat_seen = steady_clock::now();
+    while (!shared->try_push(*staging.staging)) {
+      const auto now = steady_clock::now();
+      if (const auto current = shared->heartbeat(); current != beat) {
+        beat = current;
+        beat_seen = now;
+      } else if (beat == lost_heartbeat.load(std::memory_order_relaxed) || now - beat_seen > AggregatorTimeout || !shared->aggregated()) {
+        // later buffers are given up at once, until the aggregator shows signs of life
+        if (lost_heartbeat.exchange(beat, std::memory_order_relaxed) != beat && logs<0>()) {
+          LogSink::instance().write("The aggregator is not taking readouts from the shared memory, they are discarded");
+        }
+        abandoned += (staging.staging->size - sizeof(PacketHeaderV0)) / readout_size();
+        break;
+      }
+      std::this_thread::sleep_for(microseconds(100));
+    }
+    staging.staging.reset();
+    return;
+  }
+  // with the queue full, wait to take a turn at assembling
+  while (!staged->try_push(staging.staging)) {
+    std::lock_guard lock(assembler);
+    drain();
+  }
+  std::unique_lock lock(assembler, std::try_to_lock);
+  if (lock) drain();
+}
+
+void Readout::drain() {
+  while (auto packet = staged->try_pop()) unpack(*packet);
+}
+
+void Readout::collect() {
+  drain();
+  std::lock_guard lock(producers_mutex);
+  for (auto & staging: producers) {
+    if (staging->has_data()) {
+      if (feeding()) push_staging(*staging);
+      else unpack(*staging->staging);
+    }
+    staging->staging.reset();
+  }
+}
+
+void Readout::unpack(const PacketBuffer & staged_packet) {
+  const auto * header = reinterpret_cast<const PacketHeaderV0 *>(staged_packet.data);
+  size_t offset{sizeof(PacketHeaderV0)};
+  while (offset < staged_packet.size) {
+    // every wire-format readout starts with its ring, FEN and length
+    const auto * readout = staged_packet.data + offset;
+    const auto Ring = static_cast<uint8_t>(readout[0]);
+    const auto FEN = static_cast<uint8_t>(readout[1]);
+    uint16_t length;
+    std::memcpy(&length, readout + 2, sizeof(length));
+    auto & stream = streams[stream_index(Ring, FEN)];
+    auto & queue = queue_for(stream, Ring, FEN);
+    // readouts staged before a pulse update go in packets of their own
+    if (queue.hp->PulseHigh != header->PulseHigh || queue.hp->PulseLow != header->PulseLow) {
+      if (queue.has_data()) {
+        ++counters.pulse_flushes;
+        send(stream, queue);
+      }
+      queue.hp->PulseHigh = header->PulseHigh;
+      queue.hp->PulseLow = header->PulseLow;
+      queue.hp->PrevPulseHigh = header->PrevPulseHigh;
+      queue.hp->PrevPulseLow = header->PrevPulseLow;
+    }
+    std::memcpy(queue.buffer + queue.DataSize, readout, length);
+    queue.DataSize += length;
+    queue.hp->TotalLength = queue.DataSize;
+    offset += length;
+  }
+}
+
+void Readout::publish_pulse() {
+  {
+    std::lock_guard lock(pulse_mutex);
+    pulse = PulseTimes{time, phi, plo, pphi, pplo};
+  }
+  next_pulse.store((time + period).total_ticks(), std::memory_order_relaxed);
+  pulse_generation.fetch_add(1, std::memory_order_release);
+  if (aggregating) shared->publish(pulse);
+}
+
+int Readout::aggregate_shared(const std::string & name, const size_t slots) {
+  if (shared) {
+    if (verbosity > -1) std::cout << "Readouts are already shared through shared memory\n";
+    return -1;
+  }
+  auto ring = std::make_unique<SharedRing>(name, static_cast<uint32_t>(std::max(slots, size_t(1))));
+  if (!ring->valid()) {
+    if (verbosity > -1) std::cout << "Could not create the shared memory " << name << "\n";
+    return -1;
+  }
+  enable_multi_producer();
+  shared = std::move(ring);
+  aggregating = true;
+  {
+    std::lock_guard lock(assembler);
+    publish_pulse();
+  }
+  collecting = true;
+  collector = std::thread([this](){
+    while (collecting.load(std::memory_order_acquire)) {
+      // the pulse time moves on even if this process adds no readouts
+      update_time();
+      if (!gather()) std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  });
+  return 0;
+}
+
+int Readout::feed_shared(const std::string & name) {
+  if (shared) {
+    if (verbosity > -1) std::cout << "Readouts are already shared through shared memory\n";
+    return -1;
+  }
+  auto ring = std::make_unique<SharedRing>(name);
+  if (!ring->valid()) {
+    if (verbosity > -1) std::cout << "Could not attach to the shared memory " << name << "\n";
+    return -1;
+  }
+  enable_multi_producer();
+  shared = std::move(ring);
+  return 0;
+}
+
+size_t Readout::gather() {
+  return shared->pop(pool, 16, [this](Packet staged_packet){
+    std::lock_guard lock(assembler);
+    unpack(*staged_packet);
+  });
+}
+
+void Readout::stop_aggregating() {
+  using namespace std::chrono;
+  // give the feeders time to hand over their last readouts and detach
+  const auto deadline = steady_clock::now() + seconds(10);
+  while (!shared->idle() && steady_clock::now() < deadline) {
+    if (!gather()) std::this_thread::sleep_for(milliseconds(1));
+  }
+  if (!shared->idle() && verbosity > -1) {
+    std::cout << "Feeders are still attached to the shared memory, their later readouts will not be sent\n";
+  }
+  collecting = false;
+  collector.join();
+  while (gather()) {}
+}
+
 int check_and_send_tcp(const std::string & addr, uint16_t port, std::string && message, const int verbosity){
   cluon::TCPConnection connection(addr, port,
      [](std::string &&data, auto &&ts) noexcept {
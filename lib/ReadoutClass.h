@@ -9,10 +9,19 @@
 
 #include "cluon-complete.hpp"
 
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <optional>
+#include <sstream>
 #include <random>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
 
 #include "Structs.h"
 #include "Readout.h"
@@ -21,6 +30,15 @@
 #include "version.hpp"
 #include "efu_time.h"
 #include "writer.h"
+#include "transport.h"
+#include "packet_stream.h"
+#include "producers.h"
+#include "shared_ring.h"
+#include "pulse_clock.h"
+#include "payload.h"
+#include "poisson.h"
+#include "log.h"
+#include "stage_timer.h"
 
 class Readout {
 public:
@@ -32,15 +50,18 @@ public:
         efu_time p = efu_time(1),
         efu_time t = efu_time()
   ): Type(detectorType_from_int(Type)),
+     Readout_type(readoutType_from_detectorType(this->Type)),
      ipaddr(std::move(IpAddress)),
      port(UDPPort),
      tcp_port(TCPPort),
      period(p),
-     time(t),
-     sender{ipaddr, static_cast<uint16_t>(UDPPort)}
+     time(t)
   {
 //    sockOpen(ipaddr, port);
-    hp = (PacketHeaderV0*)&buffer[0];
+    // constructed first, the log sink outlives every Readout object
+    LogSink::instance();
+    streams.emplace_back(ipaddr, port);
+    streams.front().transport = make_transport(READOUT_TRANSPORT_UDP, ipaddr, static_cast<uint16_t>(UDPPort), 1);
     auto prev = time - period;
     setPulseTime(time.high(), time.low(), prev.high(), prev.low());
     newPacket();
@@ -48,29 +69,262 @@ public:
 
   ~Readout() {
     // ensure any buffered data is sent before the object is destroyed
-    send();
+    if (aggregating) stop_aggregating();
+    if (multi_producer) collect();
+    // a feeder has handed over everything, and can let the aggregator finish
+    shared.reset();
+    for (auto & stream: streams) for (auto & queue: stream.queues) if (queue.has_data()) send(stream, queue);
+    // messages about this object's packets come before its summary
+    LogSink::instance().flush();
+    if (timing && write_stage_timing(timing_file) && verbosity >= 0) {
+      std::cout << "Writing the stage timing summary to " << timing_file << " failed\n";
+    }
+    if (pacing != READOUT_PACING_NONE && verbosity > 1) {
+      flush();
+      std::cout << "Packets held back for " << std::chrono::duration<double>(throttled()).count() << " s by the rate limit\n";
+    }
+    if (burst_delay.has_value() && verbosity > 0) {
+      flush();
+      if (auto missed = missed_deadlines()) std::cout << missed << " pulse bursts were released late\n";
+    }
   }
 
   // Adds a readout to the transmission buffer.
   // If there is no room left, transmit and initialize a new packet
   void addReadout(uint8_t Ring, uint8_t FEN, double tof, double weight, const void * data);
-  // Add a single readout
-  void addReadout(uint8_t Ring, uint8_t FEN, efu_time t, const void * data);
-  // Specializations for handled data types
-  void addReadout(uint8_t Ring, uint8_t FEN, efu_time t, const CAEN_readout_t * data);
-  void addReadout(uint8_t Ring, uint8_t FEN, efu_time t, const TTLMonitor_readout_t * data);
-  void addReadout(uint8_t Ring, uint8_t FEN, efu_time t, const DREAM_readout_t * data);
-  void addReadout(uint8_t Ring, uint8_t FEN, efu_time t, const VMM3_readout_t * data);
 
+  // Adds a readout whose payload type is known at compile time, so no per-readout dispatch is needed.
+  // Weighted readouts are repeated a Poisson-distributed number of times, noise readouts (weight == 0) once.
+  // Returns 0, or -1 without adding anything if the payload does not match the detector type.
+  template<class Payload> int add(const uint8_t Ring, const uint8_t FEN, const double tof, const double weight, const Payload & data) {
+    if (Readout_type != payload_traits<Payload>::readout) return -1;
+    StageLaps laps(stage_times());
+    // store the readout to file if requested
+    if (writer.has_value()) {
+      std::lock_guard lock(writer_mutex);
+      writer->saveReadout(Ring, FEN, tof, weight, data);
+      ++counters.written_rows;
+      laps(Stage::write);
+    }
+    if (!network){
+      if (logs<2>()) LogSink::instance().write("No readout added to buffer due to disabled network");
+      return 0;
+    }
+    if (multi_producer) {
+      auto & staging = producer();
+      refresh(staging);
+      laps.skip();
+      const auto t = efu_time(tof) + staging.pulse.time;
+      laps(Stage::time);
+      const int repeats = weight ? random_poisson(staging.random_engine, weight) : 1;
+      laps(Stage::poisson);
+      for (int i = 0; i < repeats; ++i) stageReadout(staging, Ring, FEN, t, data);
+      staging.last_event.store(t.total_ticks(), std::memory_order_relaxed);
+      ++staging.events;
+      staging.readouts += repeats;
+      count_simulated(1);
+      laps(Stage::pack);
+      return 0;
+    }
+    // provided time-of-flight plus the current pulse time
+    const auto t = efu_time(tof) + time;
+    laps(Stage::time);
+    // TODO implement t = (tof % period) + time -- such that we have realistic reference times
+    lasthi = t.high();
+    lastlo = t.low();
+    const int repeats = weight ? random_poisson(weight) : 1;
+    laps(Stage::poisson);
+    for (int i = 0; i < repeats; ++i) packReadout(Ring, FEN, t, data);
+    ++counters.events;
+    counters.readouts += repeats;
+    count_simulated(1);
+    laps(Stage::pack);
+    return 0;
+  }
+  // Adds many readouts, provided as parallel arrays plus the type-matched *_columns_t payload
+  void addReadouts(size_t count, const uint8_t * Ring, const uint8_t * FEN, const double * tof, const double * weight, const void * columns);
+
+  // Reserve the next readout slot in the packet, with the non-payload fields already filled.
+  // The slot only becomes part of the packet once commitReadout() is called.
+  // Not available in multi-producer mode, nor for a payload which does not match the detector type.
+  template<class Payload> typename payload_traits<Payload>::wire * reserveReadout(const uint8_t Ring, const uint8_t FEN, const double tof) {
+    using Data = typename payload_traits<Payload>::wire;
+    if (multi_producer || Readout_type != payload_traits<Payload>::readout) return nullptr;
+    ReservedStream = stream_index(Ring, FEN);
+    auto & stream = streams[ReservedStream];
+    auto & queue = queue_for(stream, Ring, FEN);
+    ReservedQueue = static_cast<size_t>(&queue - stream.queues.data());
+    const auto t = efu_time(tof) + time;
+    auto *dp = reinterpret_cast<Data *>(queue.buffer + queue.DataSize);
+    // an earlier uncommitted reservation may have left data behind
+    memset(dp, 0x00, sizeof(Data));
+    dp->Ring = Ring;
+    dp->FEN = FEN;
+    dp->Length = sizeof(Data);
+    dp->TimeHigh = t.high();
+    dp->TimeLow = t.low();
+    lasthi = t.high();
+    lastlo = t.low();
+    Reserved = sizeof(Data);
+    ReservedTof = tof;
+    return dp;
+  }
+  // Add the reserved readout to the packet (and file, if requested)
+  void commitReadout();
 
-  // send the current data buffer
+  // send the current data buffer of every destination
   int send();
+  // send the current data buffers which hold readouts, leaving empty ones to be filled
+  int send_pending();
+  // send any packets queued by the transport backends
+  int flush();
+
+  // Add a destination for sharded readouts, returning its index or -1 if no more can be added.
+  // The destination given at construction has index 0, and receives every readout not routed elsewhere.
+  int add_destination(const std::string & IpAddress, int UDPPort);
+  // Route readouts to destinations by their ring or FEN, or send all to the first destination
+  void set_sharding(readout_sharding by) {sharding = by;}
+  // Send readouts with this ring or FEN number to the indexed destination. Returns 0, or -1 for an unknown destination
+  int map_shard(uint8_t key, int destination);
+  // The number of destinations
+  [[nodiscard]] size_t destinations() const {return streams.size();}
+  // Spread packets over `count` EFU output queues, each with its own packet buffer and sequence counter,
+  // choosing the queue by ring, by FEN or round-robin per packet. Returns 0, or -1 for an invalid count
+  int set_output_queues(readout_output_queues policy, int count);
+
+  // Replace the transport backend, returning the backend actually in use
+  int set_transport(readout_transport type, size_t batch, bool flush_pulse);
+  // Send packets from a dedicated thread fed by a ring of `depth` buffers, or from this thread if `depth` is 0
+  void set_sender_thread(size_t depth, readout_full_ring full_ring);
+  // The number of packets discarded by the transport backends
+  [[nodiscard]] size_t dropped() const {
+    size_t count{0};
+    for (const auto & stream: streams) count += stream.transport->dropped();
+    return count;
+  }
+  // Limit the rate at which packets are sent, in readouts or bytes per second
+  void set_pacing(readout_pacing unit, double rate, double burst);
+  // The total time spent holding packets back to keep to the rate limit
+  [[nodiscard]] std::chrono::nanoseconds throttled() const {
+    std::chrono::nanoseconds total{0};
+    for (const auto & stream: streams) total += stream.transport->throttled();
+    return total;
+  }
+  // Release the packets of each pulse together, `delay` after the pulse time; or send them when ready
+  void enable_pulse_bursts(std::chrono::nanoseconds delay);
+  void disable_pulse_bursts();
+  // The time between source pulses
+  [[nodiscard]] std::chrono::nanoseconds pulse_period() const {
+    return std::chrono::nanoseconds(period.total_ticks() * 1000000000u / efu_time::ticks);
+  }
+  // Socket options used when sending to a multicast group, applied to every destination
+  void set_multicast(const MulticastOptions & options);
+  // The number of pulse bursts released later than scheduled
+  [[nodiscard]] size_t missed_deadlines() const {
+    size_t count{0};
+    for (const auto & stream: streams) count += stream.transport->missed();
+    return count;
+  }
+  // The counters kept since construction, for readout_stats; no thread may be adding readouts
+  [[nodiscard]] readout_stats_t stats();
+  // Write the counters to standard output
+  void print_stats();
+
+  // Time the stages of adding readouts and sending packets, and write a JSON summary to `filename` on destruction;
+  // or stop timing if `filename` is empty. Set while no thread is adding readouts.
+  void enable_stage_timing(const std::string & filename);
+  // Write the JSON summary of the stage timing so far, returning 0, or -1 if timing is off or the file can not be written
+  int write_stage_timing(const std::string & filename);
+
+  // Allow readouts to be added from several threads at once. Each thread packs its readouts into its own staging
+  // buffer, with its own random number generator, and full buffers are queued for a single packet assembler.
+  // Configuration, sending, and destruction must still happen while no thread is adding readouts.
+  void enable_multi_producer();
+  void disable_multi_producer();
+
+  // Share one sender between the processes on a node, through the named shared memory. The aggregator creates it,
+  // with room for `slots` staging buffers, and sends the readouts of every feeder together with its own; feeders
+  // attach to it, and stamp their readouts with the aggregator's pulse times. Both use multi-producer mode.
+  // Feeders must attach before adding readouts, and should be destroyed before the aggregator.
+  // Each returns 0, or -1 if the shared memory could not be created or attached.
+  int aggregate_shared(const std::string & name, size_t slots);
+  int feed_shared(const std::string & name);
+
+  // Take over the pulse times of another Readout object, e.g. in another process, as given by its lastPulseTime()
+  // and prevPulseTime(). Later pulses then roll over at the same times in both, as long as their clocks agree.
+  void set_pulse_reference(uint32_t PHI, uint32_t PLO, uint32_t PPHI, uint32_t PPLO);
+  // Number the packets of every output queue start, start + stride, start + 2 * stride, ... so that several
+  // senders to one Event Formation Unit use disjoint sequence numbers
+  void set_sequence(uint32_t start, uint32_t stride);
+
+  // Take the pulse times from a clock shared with other Readout objects, instead of the system clock, or go back
+  // to the system clock if `pulse_clock` is empty. Pulse batching is always used while following a clock.
+  void follow(std::shared_ptr<PulseClock> pulse_clock);
+  // Move the pulse time on by simulated pulses -- per `value` events, per call to next_simulated_pulse(), or per
+  // event at `value` events per second -- or by the system clock again. Returns 0, or -1 for an invalid mode or value
+  int set_clock(readout_clock mode, double value);
+  // Move a simulated clock on by one pulse, returning 0, or -1 if the clock is not simulated
+  int next_simulated_pulse();
+  // Whether a readout added after `pending` more events would be stamped with a later pulse time than the last one,
+  // so that a caller collecting events for addReadouts can pass on those of the current pulse first
+  bool pulse_rolls_over(uint64_t pending);
 
   // Update the pulse and previous pulse times
   void setPulseTime(uint32_t PHI, uint32_t PLO, uint32_t PPHI, uint32_t PPLO);
 
   void update_time(){
+    if (clock) {
+      follow_clock();
+      return;
+    }
+    if (clock_mode != READOUT_CLOCK_SYSTEM) {
+      simulate_pulses();
+      return;
+    }
+    if (multi_producer) {
+      // feeders follow the pulse times of their aggregator
+      if (feeding()) return;
+      // checked without locking, since every added readout gets here
+      if (efu_time().total_ticks() < next_pulse.load(std::memory_order_relaxed)) return;
+      std::unique_lock lock(assembler, std::try_to_lock);
+      // another thread is assembling, and can update the time instead
+      if (!lock) return;
+      drain();
+      roll_pulse();
+      publish_pulse();
+      return;
+    }
+    roll_pulse();
+  }
+
+private:
+  // Take the pulse times of the followed clock, once they have changed
+  void follow_clock(){
+    // checked without locking, since every added readout gets here
+    if (feeding() || clock->generation() == clock_generation.load(std::memory_order_relaxed)) return;
+    std::unique_lock lock(assembler, std::defer_lock);
+    if (multi_producer) {
+      // another thread is assembling, and can update the time instead
+      if (!lock.try_lock()) return;
+      drain();
+    }
+    PulseTimes times;
+    clock_generation = clock->pulse_times(times);
+    // send any readouts from the previous pulse, then re-stamp the (empty) packet headers
+    send_previous_pulse();
+    time = times.time;
+    setPulseTime(times.high, times.low, times.prev_high, times.prev_low);
+    for (auto & stream: streams) for (auto & queue: stream.queues) stampPulseTime(queue);
+    end_pulse();
+    if (multi_producer) publish_pulse();
+  }
+
+  void roll_pulse(){
     auto now = efu_time();
+    // pulse times taken from a host whose clock is ahead of ours are not yet over
+    if (now < time) return;
+    // with batching enabled the packet is only flushed once the pulse has rolled over
+    if (batching && (now - time) < period) return;
     if ((now - time) >= &period){
       now = time + period * ((now - time) / period);
     }
@@ -78,18 +332,89 @@ public:
     if ((now - time) > (period * 5u)) {
       time = now - period;
     }
-    send();
-    setPulseTime(now.high(), now.low(), time.high(), time.low());
-    newPacket();
+    if (batching) {
+      // send any readouts from the previous pulse, then re-stamp the (empty) packet headers
+      send_previous_pulse();
+      setPulseTime(now.high(), now.low(), time.high(), time.low());
+      for (auto & stream: streams) for (auto & queue: stream.queues) stampPulseTime(queue);
+    } else {
+      send_streams();
+      setPulseTime(now.high(), now.low(), time.high(), time.low());
+      newPacket();
+    }
+    end_pulse();
     time = now;
   }
 
+  // Move a simulated clock on once enough events have been added
+  void simulate_pulses(){
+    // checked without locking, since every added readout gets here
+    if (!counting_events || feeding()) return;
+    const auto events = simulated_events.load(std::memory_order_relaxed);
+    if (events < next_pulse_event.load(std::memory_order_relaxed)) return;
+    std::unique_lock lock(assembler, std::defer_lock);
+    if (multi_producer) {
+      // another thread is assembling, and can update the time instead
+      if (!lock.try_lock()) return;
+      drain();
+    }
+    uint32_t count{0};
+    while (events >= next_pulse_event.load(std::memory_order_relaxed)) {
+      ++count;
+      next_pulse_event = pulse_event(++simulated_pulses + 1);
+    }
+    if (count) advance_pulses(count);
+  }
+  // The number of events after which a simulated clock reaches its `pulse`-th pulse
+  [[nodiscard]] uint64_t pulse_event(const uint64_t pulse) const {
+    return simulated_start + static_cast<uint64_t>(std::ceil(static_cast<double>(pulse) * events_per_pulse));
+  }
+  // Count events added for a simulated clock
+  void count_simulated(const uint64_t events){
+    if (!counting_events) return;
+    // without other threads adding readouts the increment need not be atomic
+    if (multi_producer) simulated_events.fetch_add(events, std::memory_order_relaxed);
+    else simulated_events.store(simulated_events.load(std::memory_order_relaxed) + events, std::memory_order_relaxed);
+  }
+  // Move the pulse time on by `count` periods, sending the readouts of the previous pulse;
+  // the assembler lock must be held in multi-producer mode
+  void advance_pulses(const uint32_t count){
+    send_previous_pulse();
+    const auto previous = time + period * (count - 1);
+    time = previous + period;
+    setPulseTime(time.high(), time.low(), previous.high(), previous.low());
+    for (auto & stream: streams) for (auto & queue: stream.queues) stampPulseTime(queue);
+    end_pulse();
+    if (multi_producer) publish_pulse();
+  }
+
+  // Tell the backends the pulse time has rolled over: pulse bursts are closed without waiting for their release,
+  // otherwise any queued packets are sent if asked to on every pulse
+  void end_pulse(){
+    if (burst_delay.has_value()) {
+      for (auto & stream: streams) stream.transport->end_pulse();
+    } else if (flush_on_pulse) {
+      flush_streams();
+    }
+  }
+
+  // Send the partly filled packets left over when the pulse time rolls over
+  void send_previous_pulse(){
+    for (auto & stream: streams) for (auto & queue: stream.queues) {
+      if (!queue.has_data()) continue;
+      ++counters.pulse_flushes;
+      send(stream, queue);
+    }
+  }
+
+public:
   // Query the current pulse and previous pulse times
   [[nodiscard]] std::pair<uint32_t, uint32_t> lastPulseTime() const;
   [[nodiscard]] std::pair<uint32_t, uint32_t> prevPulseTime() const;
+  // The time of the last readout added; in multi-producer mode the latest of those last added by each thread
   [[nodiscard]] std::pair<uint32_t, uint32_t> lastEventTime() const;
 
-  // Initialize a new packet with no readouts
+  // Initialize a new packet with no readouts for every destination
   void newPacket();
 
   // Tell the (remote) device to shut down
@@ -108,25 +433,43 @@ public:
     return verbosity;
   }
   int verbose(const int v){verbosity = v; return verbosity;}
+  // Whether messages at this verbosity level are written; never for levels which are not compiled in
+  template<int Level> [[nodiscard]] bool logs() const {
+    if constexpr (log_compiled<Level>()) return verbosity >= Level;
+    else return false;
+  }
 
   void dump_to(const std::string & filename, const std::string & dataset_name = "events");
 
   void enable_network() {network = true;}
   void disable_network() {network = false;}
 
-  void set_random_seed(const uint32_t seed) {
-    random_engine.seed(seed);
+  // Send packets only when full or when the pulse rolls over (on by default),
+  // or once per call to update_time() if disabled
+  void enable_batching() {batching = true;}
+  void disable_batching() {batching = false;}
+
+  // Random numbers come from counter-based streams keyed by the seed and a stream number, e.g., the MPI rank;
+  // every thread adding readouts in multi-producer mode has a substream of its own
+  void set_random_seed(uint32_t seed);
+  void set_random_stream(uint32_t stream);
+  // Restart the random numbers of the calling thread at those for one event, so that they only depend on the seed,
+  // stream and event, whichever thread or process handles the event
+  void set_random_event(uint64_t event) {
+    (multi_producer ? producer().random_engine : random_engine).seek_event(event);
   }
 
   int random_poisson(const double mean) {
-    std::poisson_distribution<int> distribution(mean);
-    return distribution(random_engine);
+    return random_poisson(random_engine, mean);
+  }
+  static int random_poisson(Philox4x32 & engine, const double mean) {
+    return PoissonSampler::sample(engine, mean);
   }
 
 private:
   HighFive::CompoundType datatype() const {
     using namespace HighFive;
-    switch (readoutType_from_detectorType(Type)){
+    switch (Readout_type){
       case ReadoutType::CAEN: return create_datatype<CAEN_event>();
       case ReadoutType::TTLMonitor: return create_datatype<TTLMonitor_event>();
       case ReadoutType::DREAM: return create_datatype<DREAM_event>();
@@ -135,7 +478,128 @@ private:
     }
   }
 
-  void check_size_and_send();
+  // The size of one wire-format readout of this detector type
+  size_t readout_size() const {
+    switch (Readout_type){
+      case ReadoutType::CAEN: return sizeof(CaenData);
+      case ReadoutType::TTLMonitor: return sizeof(TTLMonitorData);
+      case ReadoutType::DREAM: return sizeof(DreamData);
+      case ReadoutType::VMM3: return sizeof(VMM3Data);
+      default: return 0;
+    }
+  }
+
+  // The destination of readouts from this ring and FEN
+  [[nodiscard]] uint8_t stream_index(const uint8_t Ring, const uint8_t FEN) const {
+    switch (sharding) {
+      case READOUT_SHARD_RING: return shard_of[Ring];
+      case READOUT_SHARD_FEN: return shard_of[FEN];
+      default: return 0;
+    }
+  }
+  // The output queue of a readout from this ring and FEN, with room for the readout
+  PacketQueue & queue_for(PacketStream & stream, uint8_t Ring, uint8_t FEN);
+  // Start, send, and re-stamp the packet for one output queue of a destination
+  void newPacket(PacketQueue & queue);
+  int send(PacketStream & stream, PacketQueue & queue);
+  // Count one packet handed to a transport backend, which took `elapsed` to accept it
+  void count_packet(size_t bytes, int error_code, std::chrono::nanoseconds elapsed);
+  void stampPulseTime(PacketQueue & queue);
+  // Where the calling thread records its stage timing, or nullptr if timing is off
+  StageTimes * stage_times() {
+    if (!timing) return nullptr;
+    if (!multi_producer) return timing.get();
+    auto & staging = producer();
+    if (!staging.times) staging.times = std::make_unique<StageTimes>();
+    return staging.times.get();
+  }
+  // Add or remove output queues of a destination
+  void resize_queues(PacketStream & stream, size_t count);
+  // The transport chain for one destination, as configured
+  std::unique_ptr<Transport> build_transport(const PacketStream & stream);
+  // Pack one readout into the packet for its destination, sending the packet first if it is full
+  template<class Payload> void packReadout(const uint8_t Ring, const uint8_t FEN, const efu_time t, const Payload & data) {
+    using wire = typename payload_traits<Payload>::wire;
+    auto & queue = queue_for(streams[stream_index(Ring, FEN)], Ring, FEN);
+    if (logs<3>()){
+      std::ostringstream message;
+      message << "Add to the packet Ring=" << static_cast<unsigned>(Ring) << " FEN=" << static_cast<unsigned>(FEN);
+      message << " TimeHigh=" << t.high() << " TimeLow=" << t.low();
+      payload_traits<Payload>::describe(message, data);
+      LogSink::instance().write(message.str());
+    }
+    auto *dp = reinterpret_cast<wire *>(queue.buffer + queue.DataSize);
+    dp->Ring = Ring;
+    dp->FEN = FEN;
+    dp->Length = sizeof(wire);
+    dp->TimeHigh = t.high();
+    dp->TimeLow = t.low();
+    payload_traits<Payload>::pack(dp, data);
+    queue.DataSize += sizeof(wire);
+    queue.hp->TotalLength = queue.DataSize;
+  }
+  // The staging state of the calling thread, created on its first call
+  Producer & producer();
+  // The number of Readout objects whose staging state each thread remembers, without searching for it
+  static constexpr size_t ProducerCache{4};
+  // Pick up a new pulse time, first handing over any readouts staged relative to the old one
+  void refresh(Producer & staging) {
+    const auto generation = feeding() ? shared->generation() : pulse_generation.load(std::memory_order_acquire);
+    if (generation == staging.generation) return;
+    if (staging.has_data()) push_staging(staging);
+    staging.staging.reset();
+    if (feeding()) {
+      staging.generation = shared->pulse(staging.pulse);
+      return;
+    }
+    {
+      std::lock_guard lock(pulse_mutex);
+      staging.pulse = pulse;
+    }
+    staging.generation = generation;
+  }
+  // Pack one readout into the staging buffer, queueing the buffer first if it is full
+  template<class Payload> void stageReadout(Producer & staging, const uint8_t Ring, const uint8_t FEN, const efu_time t, const Payload & data) {
+    using wire = typename payload_traits<Payload>::wire;
+    if (staging.staging && staging.staging->size >= static_cast<size_t>(MaxDataSize)) push_staging(staging);
+    if (!staging.staging) start_staging(staging);
+    auto *dp = reinterpret_cast<wire *>(staging.staging->data + staging.staging->size);
+    dp->Ring = Ring;
+    dp->FEN = FEN;
+    dp->Length = sizeof(wire);
+    dp->TimeHigh = t.high();
+    dp->TimeLow = t.low();
+    payload_traits<Payload>::pack(dp, data);
+    staging.staging->size += sizeof(wire);
+  }
+  void start_staging(Producer & staging);
+  // Queue the staging buffer for the assembler, then assemble packets if no other thread is doing so
+  void push_staging(Producer & staging);
+  // Copy the queued staging buffers into packets; the assembler lock must be held
+  void drain();
+  // Drain the queue and every thread's partly filled staging buffer; no thread may be adding readouts
+  void collect();
+  // Copy the readouts of one staging buffer into the packets for their destinations
+  void unpack(const PacketBuffer & staged);
+  // Make the current pulse times available to the producers
+  void publish_pulse();
+  // Whether readouts are handed to another process to send
+  [[nodiscard]] bool feeding() const {return shared && !aggregating;}
+  // Unpack staging buffers from the shared memory ring, returning how many there were
+  size_t gather();
+  // Wait for the feeders to detach, then stop the collector thread; this aggregator can then only be destroyed
+  void stop_aggregating();
+  // Send the current packets, or only those holding readouts, and any packets queued by the transport backends;
+  // the assembler lock must be held in multi-producer mode
+  int send_streams(bool pending_only = false);
+  int flush_streams();
+  // Time conversion, Poisson expansion and packing for a whole batch of one readout type
+  template<class Payload>
+  void packReadouts(size_t count, const uint8_t * Ring, const uint8_t * FEN, const double * tof, const double * weight, const typename payload_traits<Payload>::columns * columns);
+  template<class Payload>
+  void stageReadouts(size_t count, const uint8_t * Ring, const uint8_t * FEN, const double * tof, const double * weight, const typename payload_traits<Payload>::columns * columns);
+  // Save the reserved (wire-format) readout to file
+  template<class Payload> void saveReserved();
 
   // Packet header
   uint32_t phi{0}; // pulse and prev pulse high and low
@@ -146,15 +610,17 @@ private:
   uint32_t lasthi{0};
   uint32_t lastlo{0};
 
-  int SeqNum{0};
-  int OutputQueue{0};
   DetectorType Type;
+  // the readout type of Type, looked up once rather than per readout
+  ReadoutType Readout_type;
 
-  // TX Buffer
-  PacketHeaderV0 *hp{};
-  char buffer[9000]{};
+  // TX Buffers for every destination, which must outlive the streams' transports
+  PacketPool pool;
   const int MaxDataSize{8950};
-  int DataSize{0};
+  int Reserved{0}; // size of the reserved but uncommitted readout at buffer + DataSize of the reserved queue
+  size_t ReservedStream{0};
+  size_t ReservedQueue{0};
+  double ReservedTof{0};
   // IP and port number
   std::string ipaddr;
   int port{9000};
@@ -163,8 +629,67 @@ private:
 
   std::optional<Writer> writer{std::nullopt};
   bool network{true};
+  bool batching{true};
+  bool flush_on_pulse{false};
   efu_time period, time;
-  cluon::UDPSender sender;
+  readout_transport transport_type{READOUT_TRANSPORT_UDP};
+  size_t transport_batch{1};
+  size_t sender_depth{0};
+  readout_full_ring sender_full_ring{READOUT_FULL_RING_BLOCK};
+  readout_pacing pacing{READOUT_PACING_NONE};
+  double pacing_rate{0};
+  double pacing_burst{0};
+  std::optional<std::chrono::nanoseconds> burst_delay{std::nullopt};
+  std::optional<MulticastOptions> multicast{std::nullopt};
+  // Destinations, the first of which is ipaddr:port, and the (ring or FEN) routing to them
+  std::vector<PacketStream> streams;
+  readout_sharding sharding{READOUT_SHARD_NONE};
+  std::array<uint8_t, 256> shard_of{};
+  readout_output_queues queue_policy{READOUT_QUEUE_SINGLE};
+  uint32_t sequence_start{0};
+  uint32_t sequence_stride{1};
+  // Counters for readout_stats; producers count their own events and readouts in multi-producer mode
+  readout_stats_t counters{};
+  // Stage timing, if enabled, of this thread or, in multi-producer mode, of sending
+  std::unique_ptr<StageTimes> timing;
+  std::string timing_file;
+
+  uint32_t random_seed{static_cast<uint32_t>(std::default_random_engine{}())};
+  uint32_t random_stream{0};
+  Philox4x32 random_engine{random_seed, random_stream};
 
-  std::mt19937 random_engine{std::default_random_engine{}()};
+  // Multi-producer mode: staging buffers go through `staged` to whichever thread holds `assembler`
+  bool multi_producer{false};
+  uint64_t instance{next_instance++};
+  std::mutex assembler;
+  std::mutex writer_mutex;
+  mutable std::mutex producers_mutex;
+  std::vector<std::unique_ptr<Producer>> producers;
+  std::unique_ptr<PacketMPSC> staged;
+  std::mutex pulse_mutex;
+  PulseTimes pulse;
+  std::atomic<uint64_t> pulse_generation{0};
+  std::atomic<uint64_t> next_pulse{0};
+  // The pulse clock shared with other Readout objects, if any, and the generation of its pulse times in use
+  std::shared_ptr<PulseClock> clock;
+  std::atomic<uint64_t> clock_generation{0};
+  // A simulated clock, moved on after every `events_per_pulse` events counted from `simulated_start`
+  readout_clock clock_mode{READOUT_CLOCK_SYSTEM};
+  bool counting_events{false};
+  double events_per_pulse{0};
+  std::atomic<uint64_t> simulated_events{0};
+  std::atomic<uint64_t> next_pulse_event{0};
+  uint64_t simulated_start{0};
+  uint64_t simulated_pulses{0};
+  static inline std::atomic<uint64_t> next_instance{0};
+  // Node-local sharing: the ring, and as aggregator the thread which empties it
+  std::unique_ptr<SharedRing> shared;
+  // as feeder, how long to wait for room while the aggregator heartbeat stands still, the heartbeat at which the
+  // aggregator was last given up, and the readouts discarded since
+  static constexpr std::chrono::seconds AggregatorTimeout{1};
+  std::atomic<uint64_t> lost_heartbeat{std::numeric_limits<uint64_t>::max()};
+  std::atomic<uint64_t> abandoned{0};
+  bool aggregating{false};
+  std::atomic<bool> collecting{false};
+  std::thread collector;
 };
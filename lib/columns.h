@@ -0,0 +1,35 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Single readouts from the structure-of-arrays payloads used by readout_add_batch
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <cstddef>
+
+#include "Readout.h"
+
+// Missing (NULL) columns read as zero.
+template<class T> inline T column_value(const T * column, const size_t i) {
+  return column ? column[i] : T{};
+}
+
+inline CAEN_readout_t readout_row(const CAEN_columns_t * c, const size_t i) {
+  return {column_value(c->channel, i), column_value(c->a, i), column_value(c->b, i),
+          column_value(c->c, i), column_value(c->d, i)};
+}
+
+inline TTLMonitor_readout_t readout_row(const TTLMonitor_columns_t * c, const size_t i) {
+  return {column_value(c->channel, i), column_value(c->pos, i), column_value(c->adc, i)};
+}
+
+inline DREAM_readout_t readout_row(const DREAM_columns_t * c, const size_t i) {
+  return {column_value(c->om, i), column_value(c->cathode, i), column_value(c->anode, i)};
+}
+
+inline VMM3_readout_t readout_row(const VMM3_columns_t * c, const size_t i) {
+  return {column_value(c->bc, i), column_value(c->otadc, i), column_value(c->geo, i),
+          column_value(c->tdc, i), column_value(c->vmm, i), column_value(c->channel, i)};
+}
@@ -49,7 +49,7 @@ public:
   : Event(r, f, t, w), channel{ro->channel}, a{ro->a}, b{ro->b}, c{ro->c}, d{ro->d} {}
   template<class T> void add(T & readout) const {
     auto r = CAEN_readout{channel, a, b, c, d};
-    readout.addReadout(ring, fen, time, weight, static_cast<void *>(&r));
+    readout.add(ring, fen, time, weight, r);
 //    std::this_thread::sleep_for(std::chrono::milliseconds(10));
   }
 };
@@ -64,7 +64,7 @@ public:
   : Event(r, f, t, w), channel{p->channel}, pos{p->pos}, adc{p->adc} {}
   template<class T> void add(T & readout) const {
     auto r = TTLMonitor_readout{channel, pos, adc};
-    readout.addReadout(ring, fen, time, weight, static_cast<void *>(&r));
+    readout.add(ring, fen, time, weight, r);
 //    std::this_thread::sleep_for(std::chrono::milliseconds(10));
   }
 };
@@ -79,7 +79,7 @@ public:
   : Event(r, f, t, w), om{p->om}, cathode{p->cathode}, anode{p->anode} {}
   template<class T> void add(T & readout) const {
     auto r = DREAM_readout{om, cathode, anode};
-    readout.addReadout(ring, fen, time, weight, static_cast<void *>(&r));
+    readout.add(ring, fen, time, weight, r);
 //    std::this_thread::sleep_for(std::chrono::milliseconds(10));
   }
 };
@@ -97,7 +97,7 @@ public:
   : Event(r, f, t, w), bc{p->bc}, otadc{p->otadc}, geo{p->geo}, tdc{p->tdc}, vmm{p->vmm}, channel{p->channel} {}
   template<class T> void add(T & readout) const {
     auto r = VMM3_readout{bc, otadc, geo, tdc, vmm, channel};
-    readout.addReadout(ring, fen, time, weight, static_cast<void *>(&r));
+    readout.add(ring, fen, time, weight, r);
 //    std::this_thread::sleep_for(std::chrono::milliseconds(10));
   }
 };
@@ -0,0 +1,118 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Diagnostic messages from the per-readout and per-packet paths, written from a background thread
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+#include "mpsc.h"
+
+// The highest verbosity level whose messages are compiled in; details (3) are left out of release builds.
+// Define it, e.g., as 3 with -DREADOUT_MAX_VERBOSITY=3, to override this.
+#ifndef READOUT_MAX_VERBOSITY
+#ifdef NDEBUG
+#define READOUT_MAX_VERBOSITY 2
+#else
+#define READOUT_MAX_VERBOSITY 3
+#endif
+#endif
+
+/// \brief Whether messages at this verbosity level are compiled in
+template<int Level> constexpr bool log_compiled() {return Level <= READOUT_MAX_VERBOSITY;}
+
+/** \brief Standard output, written by a background thread from a lock-free queue of messages
+ *
+ * Writing to std::cout from the threads adding readouts serialises them on the stream's lock and the terminal;
+ * queueing a message instead only copies it. Messages are truncated to `MessageSize` characters, and if the
+ * queue is full they are counted and dropped rather than holding up the caller. The thread is started by the
+ * first message, and writes any messages still queued when the program ends.
+ */
+class LogSink {
+public:
+  static constexpr size_t MessageSize{240};
+  static constexpr size_t Capacity{4096};
+
+  /// \brief The sink shared by every Readout object
+  static LogSink & instance() {
+    static LogSink sink;
+    return sink;
+  }
+
+  /// \brief Queue one line of output, from any thread
+  void write(const std::string_view text) {
+    Message message;
+    message.size = std::min(text.size(), MessageSize);
+    std::memcpy(message.text, text.data(), message.size);
+    std::call_once(started, [this](){writer = std::thread([this](){run();});});
+    queued.fetch_add(1, std::memory_order_release);
+    if (!messages.try_push(message)) dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /// \brief Wait until every queued message has been written, e.g., before writing to std::cout directly
+  void flush() {
+    while (written.load(std::memory_order_acquire) + dropped.load(std::memory_order_relaxed) < queued.load(std::memory_order_acquire)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  ~LogSink() {
+    running = false;
+    if (writer.joinable()) writer.join();
+  }
+
+  LogSink(const LogSink &) = delete;
+  LogSink & operator=(const LogSink &) = delete;
+
+private:
+  struct Message {
+    char text[MessageSize];
+    size_t size{0};
+  };
+
+  LogSink() = default;
+
+  void run() {
+    Message message;
+    size_t batch{0};
+    size_t reported{0};
+    // keep going until the queue is empty once the program ends
+    while (true) {
+      if (messages.try_pop(message)) {
+        std::cout.write(message.text, static_cast<std::streamsize>(message.size)) << '\n';
+        ++batch;
+        continue;
+      }
+      if (const auto lost = dropped.load(std::memory_order_relaxed); lost != reported) {
+        std::cout << lost - reported << " diagnostic messages were dropped\n";
+        reported = lost;
+      }
+      // messages only count as written once they have left the stream buffer
+      if (batch) {
+        std::cout.flush();
+        written.fetch_add(batch, std::memory_order_release);
+        batch = 0;
+      }
+      if (!running) break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  BoundedMPSC<Message> messages{Capacity};
+  std::atomic<size_t> queued{0};
+  std::atomic<size_t> written{0};
+  std::atomic<size_t> dropped{0};
+  std::atomic<bool> running{true};
+  std::once_flag started;
+  std::thread writer;
+};
@@ -0,0 +1,77 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief A bounded lock-free queue with many producers and a single consumer
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/** \brief A bounded lock-free queue with many producers and a single consumer
+ *
+ * Dmitry Vyukov's bounded queue: every cell carries a sequence number which says whether it is ready to be
+ * written for a given enqueue position or read for a given dequeue position, so producers only contend on
+ * the enqueue position and never on each other's cells.
+ */
+template<class T> class BoundedMPSC {
+  struct Cell {
+    std::atomic<size_t> sequence{0};
+    T item;
+  };
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+  alignas(64) std::atomic<size_t> enqueue_position{0};
+  alignas(64) size_t dequeue_position{0};
+
+public:
+  /// @param capacity The maximum number of queued items, rounded up to a power of two
+  explicit BoundedMPSC(const size_t capacity) {
+    size_t size{2};
+    while (size < capacity) size <<= 1;
+    cells = std::make_unique<Cell[]>(size);
+    mask = size - 1;
+    for (size_t i = 0; i < size; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  /// \brief Queue the item, from any thread. Returns false, leaving the item untouched, if the queue is full
+  bool try_push(T & item) {
+    auto position = enqueue_position.load(std::memory_order_relaxed);
+    Cell * cell;
+    while (true) {
+      cell = &cells[position & mask];
+      const auto sequence = cell->sequence.load(std::memory_order_acquire);
+      const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+      if (difference == 0) {
+        if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = enqueue_position.load(std::memory_order_relaxed);
+      }
+    }
+    cell->item = std::move(item);
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// \brief Take the oldest item, from the single consuming thread. Returns a default-constructed item if there is none
+  T try_pop() {
+    T item{};
+    try_pop(item);
+    return item;
+  }
+  /// \brief Move the oldest item into `item`, from the single consuming thread. Returns false if there is none
+  bool try_pop(T & item) {
+    auto & cell = cells[dequeue_position & mask];
+    if (cell.sequence.load(std::memory_order_acquire) != dequeue_position + 1) return false;
+    item = std::move(cell.item);
+    cell.sequence.store(dequeue_position + mask + 1, std::memory_order_release);
+    ++dequeue_position;
+    return true;
+  }
+};
@@ -0,0 +1,59 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Token-bucket rate limiting for packet transmission
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+/** \brief Limit the rate at which some quantity (events, bytes) is released, allowing bursts up to a set size
+ *
+ * A token bucket, implemented as its equivalent virtual-scheduling form: every release of `n` units pushes the
+ * theoretical release time on by `n / rate`, and a release has to wait while that time is more than
+ * `burst / rate` in the future. Waits are slept for, except for the final stretch which is spun on
+ * the steady clock, so that sub-millisecond spacing is possible.
+ */
+class Pacer {
+public:
+  using clock = std::chrono::steady_clock;
+  /// \brief Sleeping is only trusted for waits longer than this; the remainder is spun
+  static constexpr clock::duration SpinThreshold{std::chrono::microseconds(200)};
+
+  /// @param rate Units released per second
+  /// @param burst Units which may be released back-to-back after an idle period
+  Pacer(const double rate, const double burst)
+  : per_unit(std::chrono::duration<double>(1 / rate)),
+    allowance(std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(burst / rate))) {}
+
+  /// \brief Wait until `amount` units may be released, then account for them
+  void pace(const double amount) {
+    auto now = clock::now();
+    const auto earliest = scheduled - allowance;
+    if (earliest > now) {
+      wait_until(earliest);
+      waited += earliest - now;
+      now = earliest;
+    }
+    scheduled = std::max(scheduled, now) + std::chrono::duration_cast<clock::duration>(per_unit * amount);
+  }
+
+  /// \brief The total time spent waiting
+  [[nodiscard]] clock::duration throttled() const {return waited;}
+
+private:
+  static void wait_until(const clock::time_point deadline) {
+    const auto remaining = deadline - clock::now();
+    if (remaining > SpinThreshold) std::this_thread::sleep_for(remaining - SpinThreshold);
+    while (clock::now() < deadline) std::this_thread::yield();
+  }
+
+  std::chrono::duration<double> per_unit;
+  clock::duration allowance;
+  clock::time_point scheduled{};
+  clock::duration waited{0};
+};
@@ -0,0 +1,86 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Reusable packet buffers, handed from the readout generator to the transmission backends
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// \brief Storage for one ESS readout packet, large enough for a jumbo frame
+struct PacketBuffer {
+  static constexpr size_t Capacity{9000};
+  size_t size{0};
+  alignas(8) char data[Capacity];
+};
+
+class PacketPool;
+
+/// \brief Returns a buffer to its pool, rather than freeing it
+struct PacketRelease {
+  PacketPool * pool{nullptr};
+  void operator()(PacketBuffer * buffer) const;
+};
+
+/// \brief Exclusive ownership of one pooled buffer; the buffer goes back to the pool when this is destroyed
+using Packet = std::unique_ptr<PacketBuffer, PacketRelease>;
+
+/** \brief A thread-safe free list of packet buffers
+ *
+ * Buffers are allocated only when none are free, and are kept until the pool is destroyed, so once
+ * every buffer a transmission backend can hold on to has been allocated no further allocation happens.
+ * Buffers are handed out uninitialised. The pool must outlive every Packet it hands out.
+ */
+class PacketPool {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<PacketBuffer>> buffers;
+  std::vector<PacketBuffer *> available;
+public:
+  PacketPool() = default;
+  PacketPool(const PacketPool &) = delete;
+  PacketPool & operator=(const PacketPool &) = delete;
+
+  Packet acquire() {
+    std::lock_guard lock(mutex);
+    if (available.empty()) {
+      buffers.emplace_back(new PacketBuffer);
+      // release() must never need to grow the free list
+      available.reserve(buffers.size());
+      return Packet(buffers.back().get(), PacketRelease{this});
+    }
+    auto buffer = available.back();
+    available.pop_back();
+    return Packet(buffer, PacketRelease{this});
+  }
+
+  /// \brief Allocate buffers up-front, until at least `count` exist
+  void reserve(const size_t count) {
+    std::lock_guard lock(mutex);
+    if (buffers.size() >= count) return;
+    available.reserve(count);
+    while (buffers.size() < count) {
+      buffers.emplace_back(new PacketBuffer);
+      available.push_back(buffers.back().get());
+    }
+  }
+
+  void release(PacketBuffer * buffer) {
+    std::lock_guard lock(mutex);
+    available.push_back(buffer);
+  }
+
+  /// \brief The number of buffers allocated so far
+  [[nodiscard]] size_t size() {
+    std::lock_guard lock(mutex);
+    return buffers.size();
+  }
+};
+
+inline void PacketRelease::operator()(PacketBuffer * buffer) const {
+  if (pool) pool->release(buffer);
+}
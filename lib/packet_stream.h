@@ -0,0 +1,51 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Per-destination packet state of the readout generator class
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Structs.h"
+#include "packet_pool.h"
+#include "transport.h"
+
+/// \brief The packet under construction for one EFU output queue
+struct PacketQueue {
+  explicit PacketQueue(const uint8_t queue): OutputQueue(queue) {}
+
+  uint8_t OutputQueue{0};
+  // TX Buffer, taken from the pool and handed to the transport once full
+  Packet packet;
+  PacketHeaderV0 *hp{};
+  char *buffer{};
+  int DataSize{0};
+  uint32_t SeqNum{0}; // of the next packet
+
+  // Whether the packet under construction holds any readouts
+  [[nodiscard]] bool has_data() const {return DataSize > static_cast<int>(sizeof(PacketHeaderV0));}
+};
+
+/** \brief Everything needed to build and send the packets for one destination
+ *
+ * Each stream has its own transport backend and, for each output queue, its own packet under construction
+ * and sequence counter, so that packets to different Event Formation Units, and to different queues of one
+ * unit, are assembled and numbered independently.
+ */
+struct PacketStream {
+  PacketStream(std::string IpAddress, const int UDPPort): ipaddr(std::move(IpAddress)), port(UDPPort) {
+    queues.emplace_back(0);
+  }
+
+  std::string ipaddr;
+  int port{9000};
+  std::vector<PacketQueue> queues;
+  size_t next{0}; // the queue being filled when packets are assigned round-robin
+  std::unique_ptr<Transport> transport;
+};
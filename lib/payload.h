@@ -0,0 +1,95 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Compile-time description of each readout payload type
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <ostream>
+
+#include "Structs.h"
+#include "Readout.h"
+#include "enums.h"
+#include "hdf_interface.h"
+
+/** \brief What the generator needs to know about a readout payload
+ *
+ * For each payload type: the ReadoutType of the detectors which use it, the wire-format readout it is
+ * packed into, the event type used to save it to file, and the payload-specific part of packing.
+ */
+template<class Payload> struct payload_traits;
+
+template<> struct payload_traits<CAEN_readout_t> {
+  using wire = CaenData;
+  using event = CAEN_event;
+  using columns = CAEN_columns_t;
+  static constexpr ReadoutType readout{ReadoutType::CAEN};
+  static void pack(wire * dp, const CAEN_readout_t & p) {
+    dp->OMFlag = 0;
+    dp->Tube = p.channel;
+    dp->SeqNum = 0;
+    dp->AmplA = p.a;
+    dp->AmplB = p.b;
+    dp->AmplC = p.c;
+    dp->AmplD = p.d;
+  }
+  static CAEN_readout_t unpack(const wire & d) {return {d.Tube, d.AmplA, d.AmplB, d.AmplC, d.AmplD};}
+  static void describe(std::ostream & os, const CAEN_readout_t & p) {
+    os << " Tube=" << static_cast<unsigned>(p.channel) << " AmplA=" << p.a << " AmplB=" << p.b;
+  }
+};
+
+template<> struct payload_traits<TTLMonitor_readout_t> {
+  using wire = TTLMonitorData;
+  using event = TTLMonitor_event;
+  using columns = TTLMonitor_columns_t;
+  static constexpr ReadoutType readout{ReadoutType::TTLMonitor};
+  static void pack(wire * dp, const TTLMonitor_readout_t & p) {
+    dp->Pos = p.pos;
+    dp->Channel = p.channel;
+    dp->ADC = p.adc;
+  }
+  static TTLMonitor_readout_t unpack(const wire & d) {return {d.Channel, d.Pos, d.ADC};}
+  static void describe(std::ostream & os, const TTLMonitor_readout_t & p) {
+    os << " Pos=" << static_cast<unsigned>(p.pos) << " Channel=" << static_cast<unsigned>(p.channel) << " ADC=" << p.adc;
+  }
+};
+
+template<> struct payload_traits<DREAM_readout_t> {
+  using wire = DreamData;
+  using event = DREAM_event;
+  using columns = DREAM_columns_t;
+  static constexpr ReadoutType readout{ReadoutType::DREAM};
+  static void pack(wire * dp, const DREAM_readout_t & p) {
+    dp->OM = p.om;
+    dp->Unused = 0;
+    dp->Cathode = p.cathode;
+    dp->Anode = p.anode;
+  }
+  static DREAM_readout_t unpack(const wire & d) {return {d.OM, d.Cathode, d.Anode};}
+  static void describe(std::ostream & os, const DREAM_readout_t & p) {
+    os << " OM=" << static_cast<unsigned>(p.om) << " Cathode=" << static_cast<unsigned>(p.cathode);
+    os << " Anode=" << static_cast<unsigned>(p.anode);
+  }
+};
+
+template<> struct payload_traits<VMM3_readout_t> {
+  using wire = VMM3Data;
+  using event = VMM3_event;
+  using columns = VMM3_columns_t;
+  static constexpr ReadoutType readout{ReadoutType::VMM3};
+  static void pack(wire * dp, const VMM3_readout_t & p) {
+    dp->BC = p.bc;
+    dp->OTADC = p.otadc;
+    dp->GEO = p.geo;
+    dp->TDC = p.tdc;
+    dp->VMM = p.vmm;
+    dp->Channel = p.channel;
+  }
+  static VMM3_readout_t unpack(const wire & d) {return {d.BC, d.OTADC, d.GEO, d.TDC, d.VMM, d.Channel};}
+  static void describe(std::ostream & os, const VMM3_readout_t & p) {
+    os << " VMM=" << static_cast<unsigned>(p.vmm) << " Channel=" << static_cast<unsigned>(p.channel);
+  }
+};
@@ -0,0 +1,95 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief A counter-based random number generator, for reproducible independent streams
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+/** \brief The Philox4x32-10 counter-based random number generator
+ *
+ * Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC11. Every block of four random numbers is a keyed
+ * bijection of a 128-bit counter, so the generator state is just the key and counter, and any position in any stream
+ * can be reached without generating the numbers before it.
+ *
+ * The key holds the seed and a stream number, e.g., the MPI rank. The counter holds a 47-bit block index, a 16-bit
+ * substream number, e.g., one per thread, and an event index; seeking to an event restarts the numbers for that
+ * event, which then only depend on the seed, stream and event, whichever thread draws them and in whichever order.
+ * The top bit of the second counter word tags the numbers of an event, so that they never overlap those of a
+ * substream, even for event 0. The block index takes the bits of that word between the substream and the tag once
+ * the first word wraps, so each substream or event has 2^49 numbers before they repeat; substreams are numbered
+ * modulo 2^16.
+ */
+class Philox4x32 {
+public:
+  using result_type = uint32_t;
+  static constexpr result_type min() {return 0;}
+  static constexpr result_type max() {return std::numeric_limits<result_type>::max();}
+
+  explicit Philox4x32(const uint32_t seed = 0, const uint32_t stream = 0, const uint32_t substream = 0)
+  : key{seed, stream}, counter{0, substream & SubstreamMask, 0, 0} {}
+
+  result_type operator()() {
+    if (index == block.size()) {
+      block = bijection(counter, key);
+      if (++counter[0] == 0) counter[1] = ((counter[1] + SubstreamMask + 1) & ~EventTag) | (counter[1] & EventTag);
+      index = 0;
+    }
+    return block[index++];
+  }
+
+  /// \brief Restart the current substream with a new seed
+  void seed(const uint32_t seed) {
+    key[0] = seed;
+    restart();
+  }
+  /// \brief Restart the current substream in a new stream
+  void set_stream(const uint32_t stream) {
+    key[1] = stream;
+    restart();
+  }
+  /// \brief Restart at the first number for one event, apart from every substream
+  void seek_event(const uint64_t event) {
+    counter = {0, EventTag, static_cast<uint32_t>(event), static_cast<uint32_t>(event >> 32)};
+    index = block.size();
+  }
+
+  /// \brief The ten-round Philox bijection of one counter value
+  static std::array<uint32_t, 4> bijection(std::array<uint32_t, 4> c, std::array<uint32_t, 2> k) {
+    for (int round = 0; round < 10; ++round) {
+      const auto first = static_cast<uint64_t>(Multiplier0) * c[0];
+      const auto second = static_cast<uint64_t>(Multiplier1) * c[2];
+      c = {static_cast<uint32_t>(second >> 32) ^ c[1] ^ k[0], static_cast<uint32_t>(second),
+           static_cast<uint32_t>(first >> 32) ^ c[3] ^ k[1], static_cast<uint32_t>(first)};
+      k[0] += Weyl0;
+      k[1] += Weyl1;
+    }
+    return c;
+  }
+
+private:
+  static constexpr uint32_t Multiplier0{0xD2511F53};
+  static constexpr uint32_t Multiplier1{0xCD9E8D57};
+  static constexpr uint32_t Weyl0{0x9E3779B9};
+  static constexpr uint32_t Weyl1{0xBB67AE85};
+  // the bits of the second counter word holding the substream, the rest continue the block index
+  static constexpr uint32_t SubstreamMask{0xFFFF};
+  // the bit of the second counter word marking the numbers of a sought event
+  static constexpr uint32_t EventTag{0x80000000};
+
+  void restart() {
+    counter[0] = 0;
+    counter[1] &= SubstreamMask | EventTag;
+    index = block.size();
+  }
+
+  std::array<uint32_t, 2> key;
+  std::array<uint32_t, 4> counter;
+  std::array<uint32_t, 4> block{};
+  size_t index{4};
+};
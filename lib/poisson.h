@@ -0,0 +1,62 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Poisson-distributed event multiplicities from McStas ray weights
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+/** \brief Draw the number of detected events represented by a weighted McStas ray
+ *
+ * Ray weights are mostly well below one, so nearly every draw is zero or one. For means below `InversionLimit` the
+ * cumulative distribution is inverted directly, without the set-up cost of constructing a std::poisson_distribution
+ * for every ray. Since exp(-mean) > 1 - mean, a uniform number below 1 - mean is a zero without evaluating the
+ * exponential at all, which settles most draws for small means with one 32-bit random number and one comparison.
+ * Larger means, which are rare, fall back on the standard library.
+ */
+struct PoissonSampler {
+  /// \brief The largest mean drawn by inversion; the number of loop iterations grows with the mean
+  static constexpr double InversionLimit{16.};
+  /// \brief The number of multiplicities which batched callers draw at a time, e.g., into a buffer on the stack
+  static constexpr size_t Chunk{64};
+
+  /// \brief One Poisson-distributed number with the given mean
+  template<class Engine> static int sample(Engine & engine, const double mean) {
+    constexpr double scale{1.0 / 4294967296.0}; // 2^-32
+    if (!(mean > 0)) return 0;
+    if (mean >= InversionLimit) return std::poisson_distribution<int>(mean)(engine);
+    // a uniform number u in [0, 1) with 53 random bits, of which the first 32 usually settle the draw
+    const auto high = static_cast<double>(static_cast<uint32_t>(engine()));
+    if ((high + 1) * scale <= 1 - mean) return 0;
+    const auto low = static_cast<double>(static_cast<uint32_t>(engine()) >> 11);
+    const auto u = (high + low * (1.0 / 2097152.0)) * scale;
+    if (u < 1 - mean) return 0;
+    return invert(u, std::exp(-mean), mean);
+  }
+
+  /// \brief Poisson-distributed numbers for `count` means, written to `out`, drawn in the same order as one-by-one
+  template<class Engine> static void sample(Engine & engine, const size_t count, const double * mean, int * out) {
+    for (size_t i = 0; i < count; ++i) out[i] = sample(engine, mean[i]);
+  }
+
+private:
+  // The smallest k for which the cumulative probability exceeds u, given the probability of zero
+  static int invert(const double u, double probability, const double mean) {
+    double cumulative = probability;
+    int k{0};
+    // the probabilities eventually underflow, should rounding leave the sum below u
+    while (u >= cumulative && probability > 0) {
+      ++k;
+      probability *= mean / k;
+      cumulative += probability;
+    }
+    return k;
+  }
+};
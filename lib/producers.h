@@ -0,0 +1,59 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Per-thread staging of readouts for the multi-producer mode of the readout generator class
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <thread>
+
+#include "Structs.h"
+#include "efu_time.h"
+#include "mpsc.h"
+#include "packet_pool.h"
+#include "philox.h"
+#include "stage_timer.h"
+
+/// \brief The pulse and previous pulse times which new readouts are relative to
+struct PulseTimes {
+  efu_time time{0u, 0u};
+  uint32_t high{0};
+  uint32_t low{0};
+  uint32_t prev_high{0};
+  uint32_t prev_low{0};
+};
+
+/** \brief The state owned by one thread adding readouts in multi-producer mode
+ *
+ * Readouts are packed into a staging buffer, laid out as a packet whose header only has its pulse times
+ * filled in, which is handed to the assembler once full or once the pulse time moves on.
+ */
+struct Producer {
+  // the thread adding readouts through this state
+  std::thread::id owner{std::this_thread::get_id()};
+  Philox4x32 random_engine;
+  Packet staging;
+  PulseTimes pulse;
+  // the pulse time generation of `pulse`, initially none
+  uint64_t generation{std::numeric_limits<uint64_t>::max()};
+  // readouts added by this thread, before and after Poisson expansion
+  uint64_t events{0};
+  uint64_t readouts{0};
+  // the time of the last readout this thread added, in EFU clock ticks, read by other threads
+  std::atomic<uint64_t> last_event{0};
+  // this thread's stage timing, once timing is enabled
+  std::unique_ptr<StageTimes> times;
+
+  // Whether the staging buffer holds any readouts
+  [[nodiscard]] bool has_data() const {return staging && staging->size > sizeof(PacketHeaderV0);}
+};
+
+/// \brief The queue of full staging buffers, from the threads adding readouts to the packet assembler
+using PacketMPSC = BoundedMPSC<Packet>;
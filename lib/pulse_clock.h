@@ -0,0 +1,90 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief A source pulse clock which several readout generators can follow
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "efu_time.h"
+#include "producers.h"
+
+/** \brief The pulse times of one source, kept up to date by a thread of its own
+ *
+ * The thread sleeps until each pulse is due, then moves the pulse and previous pulse times on and increments the
+ * pulse generation. Every Readout object following the clock checks the generation, which needs neither the system
+ * clock nor a lock, and only takes the new pulse times once it has changed; so detectors and monitors fed by one
+ * simulation are stamped with identical pulse times.
+ */
+class PulseClock {
+public:
+  /// @param pulse_period The time between source pulses
+  /// @param first_pulse The time of the first pulse, which later pulses are a whole number of periods after
+  explicit PulseClock(const efu_time pulse_period, const efu_time first_pulse = efu_time())
+  : period_(pulse_period), start(first_pulse) {
+    const auto prev = start - period_;
+    pulse = PulseTimes{start, start.high(), start.low(), prev.high(), prev.low()};
+    ticker = std::thread([this](){tick();});
+  }
+
+  ~PulseClock() {
+    {
+      std::lock_guard lock(mutex);
+      running = false;
+    }
+    wake.notify_all();
+    ticker.join();
+  }
+
+  PulseClock(const PulseClock &) = delete;
+  PulseClock & operator=(const PulseClock &) = delete;
+
+  /// \brief The time between source pulses
+  [[nodiscard]] efu_time period() const {return period_;}
+
+  /// \brief The pulse generation, incremented whenever the pulse times change, read without locking
+  [[nodiscard]] uint64_t generation() const {return generation_.load(std::memory_order_acquire);}
+
+  /// \brief The current pulse times, and their generation
+  uint64_t pulse_times(PulseTimes & times) const {
+    std::lock_guard lock(mutex);
+    times = pulse;
+    return generation_.load(std::memory_order_relaxed);
+  }
+
+private:
+  void tick() {
+    std::unique_lock lock(mutex);
+    while (running) {
+      const auto next = pulse.time + period_;
+      const auto now = efu_time();
+      if (now < next) {
+        const auto ticks = (next - now).total_ticks();
+        wake.wait_for(lock, std::chrono::nanoseconds(ticks * 1000000000u / efu_time::ticks));
+        continue;
+      }
+      // pulses missed while this thread was not scheduled are skipped
+      const auto time = start + period_ * ((now - start) / period_);
+      const auto prev = time - period_;
+      pulse = PulseTimes{time, time.high(), time.low(), prev.high(), prev.low()};
+      generation_.fetch_add(1, std::memory_order_release);
+    }
+  }
+
+  efu_time period_;
+  efu_time start;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  PulseTimes pulse;
+  std::atomic<uint64_t> generation_{0};
+  bool running{true};
+  std::thread ticker;
+};
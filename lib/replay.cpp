@@ -1,9 +1,9 @@
 #include <algorithm>
-#include <random>
 
 #include "replay.h"
 #include "reader.h"
 #include "ReadoutClass.h"
+#include "philox.h"
 
 constexpr size_t PAGESIZE = 4u << 30;  // this should be user configurable
 
@@ -23,29 +23,144 @@ bool loadable(ReadoutType type, size_t count){
 }
 
 
+constexpr size_t BATCHSIZE = 4096;  // events passed to Readout::addReadouts at once
+// the Philox stream of the event shuffle, apart from the (stream 0) multiplicities drawn by the Readout with the same seed
+constexpr uint32_t ShuffleStream = 0xFFFFFFFFu;
+
+// Structure-of-arrays copies of replayed events, which are passed to the Readout in batches
+class EventBatch {
+protected:
+  std::vector<uint8_t> ring, fen;
+  std::vector<double> time, weight;
+  void push_event(const Event & e) {
+    ring.push_back(e.ring);
+    fen.push_back(e.fen);
+    time.push_back(e.time);
+    weight.push_back(e.weight);
+  }
+  void clear_events() {
+    ring.clear();
+    fen.clear();
+    time.clear();
+    weight.clear();
+  }
+  void add_columns(Readout & readout, const void * columns) const {
+    readout.addReadouts(ring.size(), ring.data(), fen.data(), time.data(), weight.data(), columns);
+  }
+public:
+  [[nodiscard]] size_t size() const {return ring.size();}
+};
+
+class CAEN_batch: public EventBatch {
+  std::vector<uint8_t> channel;
+  std::vector<uint16_t> a, b, c, d;
+public:
+  void push(const CAEN_event & e) {
+    push_event(e);
+    channel.push_back(e.channel);
+    a.push_back(e.a);
+    b.push_back(e.b);
+    c.push_back(e.c);
+    d.push_back(e.d);
+  }
+  void add(Readout & readout) {
+    const CAEN_columns_t columns{channel.data(), a.data(), b.data(), c.data(), d.data()};
+    add_columns(readout, &columns);
+    clear_events();
+    channel.clear(); a.clear(); b.clear(); c.clear(); d.clear();
+  }
+};
+
+class TTLMonitor_batch: public EventBatch {
+  std::vector<uint8_t> channel, pos;
+  std::vector<uint16_t> adc;
+public:
+  void push(const TTLMonitor_event & e) {
+    push_event(e);
+    channel.push_back(e.channel);
+    pos.push_back(e.pos);
+    adc.push_back(e.adc);
+  }
+  void add(Readout & readout) {
+    const TTLMonitor_columns_t columns{channel.data(), pos.data(), adc.data()};
+    add_columns(readout, &columns);
+    clear_events();
+    channel.clear(); pos.clear(); adc.clear();
+  }
+};
+
+class VMM3_batch: public EventBatch {
+  std::vector<uint16_t> bc, otadc;
+  std::vector<uint8_t> geo, tdc, vmm, channel;
+public:
+  void push(const VMM3_event & e) {
+    push_event(e);
+    bc.push_back(e.bc);
+    otadc.push_back(e.otadc);
+    geo.push_back(e.geo);
+    tdc.push_back(e.tdc);
+    vmm.push_back(e.vmm);
+    channel.push_back(e.channel);
+  }
+  void add(Readout & readout) {
+    const VMM3_columns_t columns{bc.data(), otadc.data(), geo.data(), tdc.data(), vmm.data(), channel.data()};
+    add_columns(readout, &columns);
+    clear_events();
+    bc.clear(); otadc.clear(); geo.clear(); tdc.clear(); vmm.clear(); channel.clear();
+  }
+};
+
+class DREAM_batch: public EventBatch {
+  std::vector<uint8_t> om, cathode, anode;
+public:
+  void push(const DREAM_event & e) {
+    push_event(e);
+    om.push_back(e.om);
+    cathode.push_back(e.cathode);
+    anode.push_back(e.anode);
+  }
+  void add(Readout & readout) {
+    const DREAM_columns_t columns{om.data(), cathode.data(), anode.data()};
+    add_columns(readout, &columns);
+    clear_events();
+    om.clear(); cathode.clear(); anode.clear();
+  }
+};
+
+// Add events to the readout in batches, in the order given by indexes; get(i) provides the i-th event
+template<class B, class G>
+void batch_replay(Readout & readout, const std::vector<size_t> & indexes, G get){
+  B batch;
+  for (auto i: indexes) {
+    batch.push(get(i));
+    if (batch.size() == BATCHSIZE) batch.add(readout);
+  }
+  if (batch.size()) batch.add(readout);
+}
+
 void load_replay_CAEN(const Reader & reader, Readout & readout, size_t first, size_t number, const std::vector<size_t> & indexes){
   auto data = reader.get_CAEN(first, number);
-  for (auto i: indexes) data[i].add(readout);
+  batch_replay<CAEN_batch>(readout, indexes, [&data](size_t i){return data[i];});
 }
 void load_replay_TTLMonitor(const Reader & reader, Readout & readout, size_t first, size_t number, const std::vector<size_t> & indexes){
   auto data = reader.get_TTLMonitor(first, number);
-  for (auto i: indexes) data[i].add(readout);
+  batch_replay<TTLMonitor_batch>(readout, indexes, [&data](size_t i){return data[i];});
 }
 void load_replay_VMM3(const Reader & reader, Readout & readout, size_t first, size_t number, const std::vector<size_t> & indexes){
   auto data = reader.get_VMM3(first, number);
-  for (auto i: indexes) data[i].add(readout);
+  batch_replay<VMM3_batch>(readout, indexes, [&data](size_t i){return data[i];});
 }
 void load_replay_DREAM(const Reader & reader, Readout & readout, size_t first, size_t number, const std::vector<size_t> & indexes){
   auto data = reader.get_DREAM(first, number);
-  for (auto i: indexes) data[i].add(readout);
+  batch_replay<DREAM_batch>(readout, indexes, [&data](size_t i){return data[i];});
 }
 
 
-void load_replay(const Reader & reader, Readout & readout, size_t first, size_t number, int control){
+void load_replay(const Reader & reader, Readout & readout, size_t first, size_t number, int control, uint32_t seed){
   std::vector<size_t> indexes(number);
   std::iota(indexes.begin(), indexes.end(), 0u);
   if (control & RANDOM){
-    auto rng = std::default_random_engine {};
+    auto rng = Philox4x32(seed, ShuffleStream);
     std::shuffle(indexes.begin(), indexes.end(), rng);
   }
   switch (reader.readout_type()) {
@@ -58,24 +173,24 @@ void load_replay(const Reader & reader, Readout & readout, size_t first, size_t
 }
 
 void chunk_replay_CAEN(const Reader & reader, Readout & readout, const std::vector<size_t> & indexes){
-  for (auto i: indexes) reader.get_CAEN(i, 1).front().add(readout);
+  batch_replay<CAEN_batch>(readout, indexes, [&reader](size_t i){return reader.get_CAEN(i, 1).front();});
 }
 void chunk_replay_TTLMonitor(const Reader & reader, Readout & readout, const std::vector<size_t> & indexes){
-  for (auto i: indexes) reader.get_TTLMonitor(i, 1).front().add(readout);
+  batch_replay<TTLMonitor_batch>(readout, indexes, [&reader](size_t i){return reader.get_TTLMonitor(i, 1).front();});
 }
 void chunk_replay_VMM3(const Reader & reader, Readout & readout, const std::vector<size_t> & indexes){
-  for (auto i: indexes) reader.get_VMM3(i, 1).front().add(readout);
+  batch_replay<VMM3_batch>(readout, indexes, [&reader](size_t i){return reader.get_VMM3(i, 1).front();});
 }
 void chunk_replay_DREAM(const Reader & reader, Readout & readout, const std::vector<size_t> & indexes){
-  for (auto i: indexes) reader.get_DREAM(i, 1).front().add(readout);
+  batch_replay<DREAM_batch>(readout, indexes, [&reader](size_t i){return reader.get_DREAM(i, 1).front();});
 }
 
-void chunk_replay(const Reader & reader, Readout & readout, size_t first, size_t number, size_t every, int control){
+void chunk_replay(const Reader & reader, Readout & readout, size_t first, size_t number, size_t every, int control, uint32_t seed){
   std::vector<size_t> indexes(number);
   size_t i{first};
   std::generate(indexes.begin(), indexes.end(), [&i,every](){auto j=i; i+=every; return j;});
   if (control & RANDOM){
-    auto rng = std::default_random_engine {};
+    auto rng = Philox4x32(seed, ShuffleStream);
     std::shuffle(indexes.begin(), indexes.end(), rng);
   }
   switch (reader.readout_type()) {
@@ -87,22 +202,38 @@ void chunk_replay(const Reader & reader, Readout & readout, size_t first, size_t
   }
 }
 
-void replay_all(const std::string & filename, const std::string & address, int port, int control) {
+double replay_all(const std::string & filename, const std::string & address, int port, int control, double rate, double burst, uint32_t seed, const std::string & timing, double events_per_pulse) {
   auto reader = Reader(filename);
   auto readout = Readout(address, port, 0, reader.detector_type());
+  readout.set_random_seed(seed);
+  if (!timing.empty()) readout.enable_stage_timing(timing);
+  if (events_per_pulse > 0) readout.set_clock(READOUT_CLOCK_EVENTS, events_per_pulse);
+  if (rate > 0) readout.set_pacing(READOUT_PACING_EVENTS, rate, burst);
   if (loadable(reader.readout_type(), reader.size())) {
-    load_replay(reader, readout, 0, reader.size(), control);
+    load_replay(reader, readout, 0, reader.size(), control, seed);
   } else {
-    chunk_replay(reader, readout, 0, reader.size(), 1, control);
+    chunk_replay(reader, readout, 0, reader.size(), 1, control, seed);
   }
+  // the last, partly filled, packets; an empty one would only cost a throttled send
+  readout.send_pending();
+  readout.flush();
+  return std::chrono::duration<double>(readout.throttled()).count();
 }
 
-void replay_subset(const std::string & filename, const std::string & address, int port, size_t first, size_t number, size_t every, int control) {
+double replay_subset(const std::string & filename, const std::string & address, int port, size_t first, size_t number, size_t every, int control, double rate, double burst, uint32_t seed, const std::string & timing, double events_per_pulse) {
   auto reader = Reader(filename);
   auto readout = Readout(address, port, 0, reader.detector_type());
+  readout.set_random_seed(seed);
+  if (!timing.empty()) readout.enable_stage_timing(timing);
+  if (events_per_pulse > 0) readout.set_clock(READOUT_CLOCK_EVENTS, events_per_pulse);
+  if (rate > 0) readout.set_pacing(READOUT_PACING_EVENTS, rate, burst);
   if (loadable(reader.readout_type(), number) && 1 == every){
-    load_replay(reader, readout, first, number, control);
+    load_replay(reader, readout, first, number, control, seed);
   } else {
-    chunk_replay(reader, readout, first, number, every, control);
+    chunk_replay(reader, readout, first, number, every, control, seed);
   }
+  // the last, partly filled, packets; an empty one would only cost a throttled send
+  readout.send_pending();
+  readout.flush();
+  return std::chrono::duration<double>(readout.throttled()).count();
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <string>
 
 #ifdef WIN32
@@ -26,8 +27,14 @@ enum Replay {NONE = 0, ALL = 1, SEQUENTIAL = 2, RANDOM = 4};
  * @param address The IP address (or FQDN) of the EFU to receive
  * @param port The UDP port at  which the EFU is listening
  * @param control Which readouts to replay and how
+ * @param rate The maximum number of readouts sent per second, or 0 for no limit
+ * @param burst The number of readouts which may be sent back-to-back while keeping to `rate`
+ * @param seed The random seed for the replay order and the event multiplicities
+ * @param timing If not empty, the JSON file to which the time spent in each stage of sending is written
+ * @param events_per_pulse If positive, move the pulse time on after this many events instead of by the system clock
+ * @return The time, in seconds, spent holding packets back to keep to `rate`
  */
-RL_API void replay_all(const std::string & filename, const std::string & address, int port, int control);
+RL_API double replay_all(const std::string & filename, const std::string & address, int port, int control, double rate = 0., double burst = 0., uint32_t seed = 0, const std::string & timing = {}, double events_per_pulse = 0.);
 
 /** \brief Replay a subset of events from a file
  *
@@ -38,5 +45,11 @@ RL_API void replay_all(const std::string & filename, const std::string & address
  * @param number The number of events to use from the file
  * @param every The number of events (+1) to skip between those pulled from the file
  * @param control Which readouts to replay and how
+ * @param rate The maximum number of readouts sent per second, or 0 for no limit
+ * @param burst The number of readouts which may be sent back-to-back while keeping to `rate`
+ * @param seed The random seed for the replay order and the event multiplicities
+ * @param timing If not empty, the JSON file to which the time spent in each stage of sending is written
+ * @param events_per_pulse If positive, move the pulse time on after this many events instead of by the system clock
+ * @return The time, in seconds, spent holding packets back to keep to `rate`
  */
-RL_API void replay_subset(const std::string & filename, const std::string & address, int port, size_t first, size_t number, size_t every, int control);
\ No newline at end of file
+RL_API double replay_subset(const std::string & filename, const std::string & address, int port, size_t first, size_t number, size_t every, int control, double rate = 0., double burst = 0., uint32_t seed = 0, const std::string & timing = {}, double events_per_pulse = 0.);
\ No newline at end of file
@@ -0,0 +1,185 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief A node-local shared-memory ring of staged readouts, for processes which share one sender
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include "cluon-complete.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+
+#include "packet_pool.h"
+#include "producers.h"
+
+/** \brief Staging buffers passed from feeding processes to the one aggregating process on a node
+ *
+ * The aggregator creates the named shared memory, and publishes its pulse times through it so that every
+ * feeder stamps its readouts relative to the same pulse. Feeders attach to it, and copy each full staging
+ * buffer into the next free slot. Slots are claimed and released under the shared memory lock; the pulse
+ * generation counter may additionally be read without it, to check cheaply whether the pulse has moved on.
+ * The aggregator bumps a heartbeat whenever it looks for filled slots, and clears its flag on destruction, so a
+ * feeder waiting for room can tell whether it will ever get any.
+ */
+class SharedRing {
+  static constexpr uint32_t Magic{0x52534545}; // "EESR"
+
+  struct Header {
+    uint32_t magic;
+    uint32_t slots;
+    uint64_t head;       // the number of slots filled by feeders
+    uint64_t tail;       // the number of slots emptied by the aggregator
+    uint64_t generation; // incremented whenever the pulse times change
+    uint32_t time_high;
+    uint32_t time_low;
+    uint32_t high;
+    uint32_t low;
+    uint32_t prev_high;
+    uint32_t prev_low;
+    uint32_t feeders;    // the number of attached feeders
+    uint32_t aggregating; // 1 while the aggregator is attached
+    uint64_t heartbeat;  // incremented whenever the aggregator looks for filled slots
+  };
+
+  cluon::SharedMemory memory;
+  Header * header{nullptr};
+  PacketBuffer * slots{nullptr};
+  bool feeding{false};
+
+  void map() {
+    if (!memory.valid() || memory.size() < sizeof(Header)) return;
+    header = reinterpret_cast<Header *>(memory.data());
+    slots = reinterpret_cast<PacketBuffer *>(memory.data() + sizeof(Header));
+  }
+
+public:
+  /// \brief Create the named ring with room for `count` staging buffers, as the aggregator
+  SharedRing(const std::string & name, const uint32_t count)
+  : memory(name, static_cast<uint32_t>(sizeof(Header) + count * sizeof(PacketBuffer))) {
+    map();
+    if (header == nullptr) return;
+    memory.lock();
+    std::memset(header, 0, sizeof(Header));
+    header->slots = count;
+    header->aggregating = 1;
+    header->magic = Magic;
+    memory.unlock();
+  }
+
+  /// \brief Attach to the named ring, as a feeder
+  explicit SharedRing(const std::string & name): memory(name), feeding(true) {
+    map();
+    if (header == nullptr) return;
+    memory.lock();
+    if (header->magic == Magic && memory.size() >= sizeof(Header) + header->slots * sizeof(PacketBuffer)) {
+      ++header->feeders;
+    } else {
+      header = nullptr;
+    }
+    memory.unlock();
+  }
+
+  ~SharedRing() {
+    if (header == nullptr) return;
+    memory.lock();
+    if (feeding) {
+      --header->feeders;
+    } else {
+      header->aggregating = 0;
+    }
+    memory.unlock();
+  }
+
+  SharedRing(const SharedRing &) = delete;
+  SharedRing & operator=(const SharedRing &) = delete;
+
+  /// \brief Whether the ring exists and has the expected layout
+  [[nodiscard]] bool valid() const {return header != nullptr;}
+
+  /// \brief Copy the staging buffer into a free slot. Returns false if every slot is in use
+  bool try_push(const PacketBuffer & staged) {
+    memory.lock();
+    const bool room = header->head - header->tail < header->slots;
+    if (room) {
+      auto & slot = slots[header->head % header->slots];
+      slot.size = staged.size;
+      std::memcpy(slot.data, staged.data, staged.size);
+      ++header->head;
+    }
+    memory.unlock();
+    return room;
+  }
+
+  /// \brief Copy up to `count` filled slots into buffers from the pool, oldest first, and hand each to `take`
+  template<class Take> size_t pop(PacketPool & pool, const size_t count, Take take) {
+    Packet packets[16];
+    size_t popped{0};
+    memory.lock();
+    std::atomic_ref<uint64_t>(header->heartbeat).fetch_add(1, std::memory_order_relaxed);
+    while (popped < count && popped < std::size(packets) && header->tail < header->head) {
+      const auto & slot = slots[header->tail % header->slots];
+      packets[popped] = pool.acquire();
+      packets[popped]->size = slot.size;
+      std::memcpy(packets[popped]->data, slot.data, slot.size);
+      ++header->tail;
+      ++popped;
+    }
+    memory.unlock();
+    for (size_t i = 0; i < popped; ++i) take(std::move(packets[i]));
+    return popped;
+  }
+
+  /// \brief Whether no feeder is attached and no slot is filled
+  [[nodiscard]] bool idle() {
+    memory.lock();
+    const bool done = header->feeders == 0 && header->tail == header->head;
+    memory.unlock();
+    return done;
+  }
+
+  /// \brief The aggregator heartbeat, read without locking
+  [[nodiscard]] uint64_t heartbeat() const {
+    return std::atomic_ref<uint64_t>(header->heartbeat).load(std::memory_order_relaxed);
+  }
+
+  /// \brief Whether the aggregator is still attached
+  [[nodiscard]] bool aggregated() {
+    memory.lock();
+    const bool attached = header->aggregating != 0;
+    memory.unlock();
+    return attached;
+  }
+
+  /// \brief Make new pulse times available to the feeders
+  void publish(const PulseTimes & pulse) {
+    memory.lock();
+    header->time_high = pulse.time.high();
+    header->time_low = pulse.time.low();
+    header->high = pulse.high;
+    header->low = pulse.low;
+    header->prev_high = pulse.prev_high;
+    header->prev_low = pulse.prev_low;
+    std::atomic_ref<uint64_t>(header->generation).fetch_add(1, std::memory_order_release);
+    memory.unlock();
+  }
+
+  /// \brief The pulse time generation, read without locking
+  [[nodiscard]] uint64_t generation() const {
+    return std::atomic_ref<uint64_t>(header->generation).load(std::memory_order_acquire);
+  }
+
+  /// \brief The current pulse times, and their generation
+  uint64_t pulse(PulseTimes & pulse) {
+    memory.lock();
+    pulse = PulseTimes{efu_time(header->time_high, header->time_low), header->high, header->low, header->prev_high, header->prev_low};
+    const auto current = header->generation;
+    memory.unlock();
+    return current;
+  }
+};
@@ -0,0 +1,156 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Optional timing of the stages of adding readouts, summarised as JSON
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+
+/// \brief The stages of adding readouts and sending them which can be timed
+enum class Stage {time, poisson, pack, write, send};
+constexpr size_t StageCount{5};
+
+/// \brief The name of a stage in the timing summary
+constexpr std::string_view stage_name(const Stage stage) {
+  switch (stage) {
+    case Stage::time: return "efu_time";
+    case Stage::poisson: return "poisson";
+    case Stage::pack: return "pack";
+    case Stage::write: return "write";
+    case Stage::send: return "send";
+    default: return "unknown";
+  }
+}
+
+/** \brief The distribution of the durations of one stage, in nanoseconds
+ *
+ * Durations are counted in logarithmic bins, four per power of two, so percentiles are known to within an eighth
+ * of their value whatever their range; the total and maximum are exact.
+ */
+class StageHistogram {
+public:
+  static constexpr size_t Bins{252};
+
+  void record(const uint64_t ns) {
+    ++counts[bin(ns)];
+    ++samples;
+    sum += ns;
+    longest = std::max(longest, ns);
+  }
+  StageHistogram & operator+=(const StageHistogram & other) {
+    for (size_t i = 0; i < Bins; ++i) counts[i] += other.counts[i];
+    samples += other.samples;
+    sum += other.sum;
+    longest = std::max(longest, other.longest);
+    return *this;
+  }
+
+  [[nodiscard]] uint64_t count() const {return samples;}
+  [[nodiscard]] uint64_t total() const {return sum;}
+  [[nodiscard]] uint64_t max() const {return longest;}
+  /// \brief The duration which a fraction `q` of the samples do not exceed, as the middle of its bin
+  [[nodiscard]] uint64_t percentile(const double q) const {
+    if (!samples) return 0;
+    const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * static_cast<double>(samples) + 0.5));
+    uint64_t seen{0};
+    for (size_t i = 0; i < Bins; ++i) {
+      seen += counts[i];
+      if (seen >= rank) return std::min(longest, lower(i) + width(i) / 2);
+    }
+    return longest;
+  }
+
+  /// \brief The bin of a duration: exact below 4 ns, then the top three significant bits
+  static size_t bin(const uint64_t ns) {
+    if (ns < 4) return static_cast<size_t>(ns);
+    const auto exponent = static_cast<size_t>(std::bit_width(ns)) - 1;
+    return 4 * (exponent - 1) + static_cast<size_t>((ns >> (exponent - 2)) & 3);
+  }
+  static uint64_t lower(const size_t index) {
+    if (index < 4) return index;
+    return (4 + index % 4) << (index / 4 - 1);
+  }
+  static uint64_t width(const size_t index) {
+    return index < 4 ? 1 : uint64_t(1) << (index / 4 - 1);
+  }
+
+private:
+  std::array<uint64_t, Bins> counts{};
+  uint64_t samples{0};
+  uint64_t sum{0};
+  uint64_t longest{0};
+};
+
+/// \brief The durations of every stage, recorded by one thread
+struct StageTimes {
+  std::array<StageHistogram, StageCount> stages;
+
+  void record(const Stage stage, const std::chrono::nanoseconds elapsed) {
+    stages[static_cast<size_t>(stage)].record(static_cast<uint64_t>(std::max<int64_t>(0, elapsed.count())));
+  }
+  StageTimes & operator+=(const StageTimes & other) {
+    for (size_t i = 0; i < StageCount; ++i) stages[i] += other.stages[i];
+    return *this;
+  }
+
+  /// \brief Write the number of samples, total, mean, percentiles and maximum of every stage, in nanoseconds
+  void write_json(std::ostream & out) const {
+    out << "{\n  \"unit\": \"ns\",\n  \"stages\": {";
+    for (size_t i = 0; i < StageCount; ++i) {
+      const auto & h = stages[i];
+      out << (i ? ",\n" : "\n") << "    \"" << stage_name(static_cast<Stage>(i)) << "\": {";
+      out << "\"count\": " << h.count() << ", \"total\": " << h.total();
+      out << ", \"mean\": " << (h.count() ? static_cast<double>(h.total()) / static_cast<double>(h.count()) : 0.);
+      out << ", \"p50\": " << h.percentile(0.5) << ", \"p90\": " << h.percentile(0.9);
+      out << ", \"p99\": " << h.percentile(0.99) << ", \"max\": " << h.max() << "}";
+    }
+    out << "\n  }\n}\n";
+  }
+};
+
+/** \brief Times consecutive stages of one call: each lap is recorded against a stage as the time since the
+ * previous lap, or since construction, less any time this thread spent in stages timed on their own meanwhile
+ *
+ * Without anywhere to record to, the clock is never read and a lap is a single comparison.
+ */
+class StageLaps {
+public:
+  explicit StageLaps(StageTimes * times): times(times) {
+    if (times) restart();
+  }
+  void operator()(const Stage stage) {
+    if (!times) return;
+    const auto now = std::chrono::steady_clock::now();
+    times->record(stage, now - last - (nested - seen));
+    last = now;
+    seen = nested;
+  }
+  /// \brief Leave the time since the previous lap out of every stage
+  void skip() {
+    if (times) restart();
+  }
+  /// \brief Leave `elapsed`, already recorded against its own stage, out of the lap this thread is in,
+  /// e.g., a packet sent because packing a readout filled it
+  static void exclude(const std::chrono::nanoseconds elapsed) {nested += elapsed;}
+
+private:
+  void restart() {
+    last = std::chrono::steady_clock::now();
+    seen = nested;
+  }
+
+  StageTimes * times;
+  std::chrono::steady_clock::time_point last;
+  std::chrono::nanoseconds seen{0};
+  static inline thread_local std::chrono::nanoseconds nested{0};
+};
@@ -0,0 +1,611 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Packet transmission backends implementation
+///
+//===----------------------------------------------------------------------===//
+#include "transport.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include "efu_time.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <netinet/udp.h>
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#include <sys/timerfd.h>
+#ifdef READOUT_HAS_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#ifndef _WIN32
+namespace {
+  sockaddr_in resolve(const std::string & address, const uint16_t port) {
+    sockaddr_in destination{};
+    destination.sin_family = AF_INET;
+    destination.sin_port = htons(port);
+    destination.sin_addr.s_addr = ::inet_addr(cluon::getIPv4FromHostname(address).c_str());
+    return destination;
+  }
+}
+
+SocketTransport::SocketTransport(const std::string & address, const uint16_t port)
+: destination(resolve(address, port)) {
+  socket_fd = ::socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (socket_fd < 0) {
+    throw std::runtime_error(std::string("Could not create UDP socket: ") + std::strerror(errno));
+  }
+}
+
+SocketTransport::~SocketTransport() {
+  ::close(socket_fd);
+}
+
+int SocketTransport::set_multicast(const MulticastOptions & options) {
+  // BSD-derived systems only accept a single byte for these options, which Linux also accepts
+  const auto ttl = static_cast<unsigned char>(std::clamp(options.ttl, 0, 255));
+  const unsigned char loop = options.loop ? 1 : 0;
+  if (::setsockopt(socket_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) return errno;
+  if (::setsockopt(socket_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) return errno;
+  if (!options.interface_address.empty()) {
+    in_addr address{};
+    if (::inet_pton(AF_INET, options.interface_address.c_str(), &address) != 1) return EINVAL;
+    if (::setsockopt(socket_fd, IPPROTO_IP, IP_MULTICAST_IF, &address, sizeof(address)) < 0) return errno;
+  }
+  return 0;
+}
+
+int SocketTransport::send_to(const char * data, const size_t size) const {
+  auto bytes = ::sendto(socket_fd, data, size, 0, reinterpret_cast<const sockaddr *>(&destination), sizeof(destination));
+  return bytes < 0 ? errno : 0;
+}
+
+int UDPTransport::send(Packet packet) {
+  return send_to(packet->data, packet->size);
+}
+#else
+int UDPTransport::send(Packet packet) {
+  auto [bytes, error_code] = sender.send(std::string(packet->data, packet->data + packet->size));
+  return error_code;
+}
+#endif
+
+#ifdef __linux__
+MMsgTransport::MMsgTransport(const std::string & address, const uint16_t port, const size_t batch)
+: SocketTransport(address, port), batch(batch ? batch : 1) {
+  packets.resize(this->batch);
+  vectors.resize(this->batch);
+  messages.resize(this->batch);
+  for (size_t i=0; i<this->batch; ++i){
+    messages[i].msg_hdr.msg_name = &destination;
+    messages[i].msg_hdr.msg_namelen = sizeof(destination);
+    messages[i].msg_hdr.msg_iov = &vectors[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+MMsgTransport::~MMsgTransport() {
+  flush();
+}
+
+int MMsgTransport::send(Packet packet) {
+  vectors[queued].iov_base = packet->data;
+  vectors[queued].iov_len = packet->size;
+  packets[queued] = std::move(packet);
+  return ++queued < batch ? 0 : flush();
+}
+
+int MMsgTransport::flush() {
+  size_t sent{0};
+  int error_code{0};
+  while (sent < queued) {
+    auto count = ::sendmmsg(socket_fd, messages.data() + sent, static_cast<unsigned>(queued - sent), 0);
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      // the remaining packets are dropped, as the single packet sender would have done
+      error_code = errno;
+      break;
+    }
+    sent += static_cast<size_t>(count);
+  }
+  for (size_t i=0; i<queued; ++i) packets[i].reset();
+  queued = 0;
+  return error_code;
+}
+
+GSOTransport::GSOTransport(const std::string & address, const uint16_t port, const size_t batch)
+: SocketTransport(address, port), batch(std::clamp<size_t>(batch, 1, MaxSegments)),
+  packets(this->batch), vectors(this->batch) {
+  // kernels without segmentation offload do not know the socket option
+  int size{static_cast<int>(MaxPacketSize)};
+  if (::setsockopt(socket_fd, IPPROTO_UDP, UDP_SEGMENT, &size, sizeof(size)) < 0) {
+    offload = false;
+  } else {
+    size = 0;
+    ::setsockopt(socket_fd, IPPROTO_UDP, UDP_SEGMENT, &size, sizeof(size));
+  }
+}
+
+GSOTransport::~GSOTransport() {
+  flush();
+}
+
+int GSOTransport::send(Packet packet) {
+  const auto size = packet->size;
+  if (!offload) return send_to(packet->data, size);
+  int error_code{0};
+  // a burst is made from equal-size segments, optionally followed by one shorter segment
+  if (queued && (size > segment || used + size > MaxBurstSize)) error_code = flush();
+  if (!queued) segment = size;
+  vectors[queued].iov_base = packet->data;
+  vectors[queued].iov_len = size;
+  packets[queued] = std::move(packet);
+  used += size;
+  if (++queued >= batch || size < segment) {
+    auto flush_error = flush();
+    if (flush_error) error_code = flush_error;
+  }
+  return error_code;
+}
+
+int GSOTransport::flush() {
+  if (!queued) return 0;
+  auto error_code = queued > 1 ? send_queue() : send_to(packets[0]->data, used);
+  for (size_t i=0; i<queued; ++i) packets[i].reset();
+  queued = 0;
+  used = 0;
+  return error_code;
+}
+
+int GSOTransport::send_queue() {
+  char control[CMSG_SPACE(sizeof(uint16_t))]{};
+  msghdr message{};
+  message.msg_name = &destination;
+  message.msg_namelen = sizeof(destination);
+  message.msg_iov = vectors.data();
+  message.msg_iovlen = queued;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  auto * cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = IPPROTO_UDP;
+  cmsg->cmsg_type = UDP_SEGMENT;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+  const auto segment_size = static_cast<uint16_t>(segment);
+  std::memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+  ssize_t bytes;
+  do {
+    bytes = ::sendmsg(socket_fd, &message, 0);
+  } while (bytes < 0 && errno == EINTR);
+  if (bytes >= 0) return 0;
+  // a full socket buffer, or the like, loses this burst but says nothing about segmentation
+  const auto failure = errno;
+  if (failure != EIO && failure != EINVAL && failure != EOPNOTSUPP) return failure;
+  // the kernel (or the network device) refused to segment the burst: stop trying and send segments individually
+  offload = false;
+  int error_code{0};
+  for (size_t i=0; i<queued; ++i) {
+    auto error = send_to(packets[i]->data, packets[i]->size);
+    if (error) error_code = error;
+  }
+  return error_code;
+}
+
+#ifdef READOUT_HAS_IO_URING
+UringTransport::UringTransport(const std::string & address, const uint16_t port, const size_t depth)
+: SocketTransport(address, port) {
+  io_uring_params params{};
+  ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, static_cast<unsigned>(std::clamp<size_t>(depth, 1, 4096)), &params));
+  if (ring_fd < 0) {
+    throw std::runtime_error(std::string("Could not set up io_uring: ") + std::strerror(errno));
+  }
+  sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+  sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  cq_ring = single_mmap ? sq_ring : ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+  sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  auto sqes_ptr = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes_ptr == MAP_FAILED) {
+    auto error = std::string("Could not map io_uring: ") + std::strerror(errno);
+    if (sq_ring != MAP_FAILED) ::munmap(sq_ring, sq_ring_size);
+    if (!single_mmap && cq_ring != MAP_FAILED) ::munmap(cq_ring, cq_ring_size);
+    if (sqes_ptr != MAP_FAILED) ::munmap(sqes_ptr, sqes_size);
+    ::close(ring_fd);
+    throw std::runtime_error(error);
+  }
+  sqes = static_cast<io_uring_sqe *>(sqes_ptr);
+  auto sq = static_cast<char *>(sq_ring);
+  auto cq = static_cast<char *>(cq_ring);
+  sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  // one packet slot per submission queue entry, so the completion queue can never overflow
+  slots.resize(params.sq_entries);
+  batch = static_cast<unsigned>(std::clamp<size_t>(depth, 1, params.sq_entries));
+  free_slots.reserve(params.sq_entries);
+  for (unsigned i=0; i<params.sq_entries; ++i) {
+    auto & slot = slots[i];
+    slot.message = msghdr{};
+    slot.message.msg_name = &destination;
+    slot.message.msg_namelen = sizeof(destination);
+    slot.message.msg_iov = &slot.vector;
+    slot.message.msg_iovlen = 1;
+    free_slots.push_back(params.sq_entries - 1 - i);
+  }
+}
+
+UringTransport::~UringTransport() {
+  flush();
+  ::munmap(sqes, sqes_size);
+  if (cq_ring != sq_ring) ::munmap(cq_ring, cq_ring_size);
+  ::munmap(sq_ring, sq_ring_size);
+  ::close(ring_fd);
+}
+
+int UringTransport::enter(const unsigned min_complete, const unsigned flags) {
+  long result;
+  do {
+    result = ::syscall(__NR_io_uring_enter, ring_fd, unsubmitted, min_complete, flags, nullptr, 0);
+  } while (result < 0 && errno == EINTR);
+  if (result < 0) return errno;
+  // the kernel only waits once it has taken every entry, the rest stay queued for the next call
+  unsubmitted -= static_cast<unsigned>(result);
+  return 0;
+}
+
+void UringTransport::harvest() {
+  auto head = *cq_head;
+  const auto tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const auto & cqe = cqes[head & *cq_mask];
+    if (cqe.res < 0) last_error = -cqe.res;
+    slots[cqe.user_data].packet.reset();
+    free_slots.push_back(static_cast<unsigned>(cqe.user_data));
+    --in_flight;
+  }
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+int UringTransport::send(Packet packet) {
+  harvest();
+  while (free_slots.empty()) {
+    // every slot is in flight, make sure the kernel has them all and wait for at least one to be released
+    const auto waiting = unsubmitted;
+    if (auto error = enter(1, IORING_ENTER_GETEVENTS)) return error;
+    harvest();
+    if (free_slots.empty() && unsubmitted && unsubmitted == waiting) return EAGAIN;
+  }
+  const auto index = free_slots.back();
+  free_slots.pop_back();
+  auto & slot = slots[index];
+  slot.vector.iov_base = packet->data;
+  slot.vector.iov_len = packet->size;
+  slot.packet = std::move(packet);
+
+  const auto tail = *sq_tail;
+  const auto position = tail & *sq_mask;
+  auto & sqe = sqes[position];
+  std::memset(&sqe, 0, sizeof(sqe));
+  sqe.opcode = IORING_OP_SENDMSG;
+  sqe.fd = socket_fd;
+  sqe.addr = reinterpret_cast<uint64_t>(&slot.message);
+  sqe.len = 1;
+  sqe.user_data = index;
+  sq_array[position] = position;
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ++in_flight;
+  ++unsubmitted;
+  int error_code{0};
+  if (unsubmitted >= batch) error_code = enter(0, 0);
+  if (!error_code) std::swap(error_code, last_error);
+  return error_code;
+}
+
+int UringTransport::flush() {
+  while (in_flight) {
+    const auto waiting = unsubmitted;
+    if (auto error = enter(in_flight, IORING_ENTER_GETEVENTS)) return error;
+    harvest();
+    // the kernel took none of the remaining entries, and has nothing left to complete
+    if (unsubmitted && unsubmitted == waiting && in_flight == unsubmitted) return EAGAIN;
+  }
+  int error_code{0};
+  std::swap(error_code, last_error);
+  return error_code;
+}
+#endif
+#endif
+
+ThreadedTransport::ThreadedTransport(std::unique_ptr<Transport> transport, const size_t depth, const readout_full_ring policy)
+: inner(std::move(transport)), policy(policy), ring(depth ? depth : 1) {
+  sender = std::thread(&ThreadedTransport::run, this);
+}
+
+ThreadedTransport::~ThreadedTransport() {
+  running = false;
+  ++wakeups;
+  wakeups.notify_one();
+  sender.join();
+}
+
+void ThreadedTransport::run() {
+  size_t popped{0};
+  size_t served{0};
+  size_t ended{0};
+  // pass on the end of a pulse once every packet pushed before it has been handed over
+  auto end_pulse_at = [&](){
+    const auto at = pulse_ends.load(std::memory_order_acquire);
+    if (at != ended && at == popped) {
+      inner->end_pulse();
+      ended = at;
+    }
+  };
+  while (true) {
+    // read before checking for packets, so that a push in between is never slept through
+    const auto wakeup = wakeups.load();
+    // and a flush asked for after that push is not served before sending it
+    const auto requests = flush_requests.load();
+    if (popped == pushed.load()) {
+      end_pulse_at();
+      // nothing left to send, so make sure the wrapped backend is not holding on to anything;
+      // only a flush waits for packets it holds back until later
+      const auto error_code = requests != served ? inner->flush() : inner->idle();
+      if (error_code) error = error_code;
+      if (requests != served) {
+        served = requests;
+        flushes.store(served, std::memory_order_release);
+        flushes.notify_all();
+      }
+      if (!running && popped == pushed.load()) return;
+      wakeups.wait(wakeup);
+      continue;
+    }
+    const auto position = head.load(std::memory_order_relaxed);
+    int error_code;
+    if (position != tail.load(std::memory_order_acquire)) {
+      auto packet = std::move(ring[position % ring.size()]);
+      head.store(position + 1, std::memory_order_release);
+      head.notify_one();
+      end_pulse_at();
+      error_code = inner->send(std::move(packet));
+    } else {
+      std::unique_lock lock(overflow_mutex);
+      // the producer only spills when the ring is full, so anything it wrote to the ring goes first
+      if (position != tail.load(std::memory_order_acquire)) continue;
+      auto packet = std::move(overflow.front());
+      overflow.pop_front();
+      lock.unlock();
+      end_pulse_at();
+      error_code = inner->send(std::move(packet));
+      overflowing.fetch_sub(1, std::memory_order_release);
+    }
+    if (error_code) error = error_code;
+    ++popped;
+  }
+}
+
+int ThreadedTransport::send(Packet packet) {
+  const auto position = tail.load(std::memory_order_relaxed);
+  auto full = [&](){return position - head.load(std::memory_order_acquire) >= ring.size();};
+  if (policy == READOUT_FULL_RING_GROW && (overflowing.load(std::memory_order_acquire) || full())) {
+    std::lock_guard lock(overflow_mutex);
+    overflow.push_back(std::move(packet));
+    overflowing.fetch_add(1, std::memory_order_release);
+  } else {
+    if (full()) {
+      if (policy == READOUT_FULL_RING_DROP) {
+        ++discarded;
+        return error.exchange(0);
+      }
+      for (auto observed = head.load(std::memory_order_acquire); full(); observed = head.load(std::memory_order_acquire)) {
+        head.wait(observed, std::memory_order_acquire);
+      }
+    }
+    ring[position % ring.size()] = std::move(packet);
+    tail.store(position + 1, std::memory_order_release);
+  }
+  ++pushed;
+  ++wakeups;
+  wakeups.notify_one();
+  return error.exchange(0);
+}
+
+int ThreadedTransport::flush() {
+  const auto request = ++flush_requests;
+  ++wakeups;
+  wakeups.notify_one();
+  for (auto done = flushes.load(std::memory_order_acquire); done < request; done = flushes.load(std::memory_order_acquire)) {
+    flushes.wait(done, std::memory_order_acquire);
+  }
+  return error.exchange(0);
+}
+
+void ThreadedTransport::end_pulse() {
+  pulse_ends.store(pushed.load(std::memory_order_relaxed), std::memory_order_release);
+  ++wakeups;
+  wakeups.notify_one();
+}
+
+PacedTransport::PacedTransport(std::unique_ptr<Transport> transport, const readout_pacing unit, const double rate,
+                               const double burst, const size_t readout_size)
+: inner(std::move(transport)), unit(unit), readout_size(readout_size ? readout_size : 1), pacer(rate, burst) {}
+
+int PacedTransport::send(Packet packet) {
+  const auto bytes = packet->size;
+  const auto amount = unit == READOUT_PACING_BYTES ? bytes : (bytes - std::min(bytes, sizeof(PacketHeaderV0))) / readout_size;
+  pacer.pace(static_cast<double>(amount));
+  waited = std::chrono::duration_cast<std::chrono::nanoseconds>(pacer.throttled()).count();
+  return inner->send(std::move(packet));
+}
+
+PulseBurstTransport::PulseBurstTransport(std::unique_ptr<Transport> transport, const std::chrono::nanoseconds delay)
+: inner(std::move(transport)), delay(delay) {
+#ifdef __linux__
+  // without a timer the scheduler falls back to sleeping until each deadline
+  timer_fd = ::timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+#endif
+  // one group being filled while the previous waits for its deadline
+  for (int i = 0; i < 2; ++i) spare.push_back(take_burst());
+  scheduler = std::thread(&PulseBurstTransport::run, this);
+}
+
+PulseBurstTransport::~PulseBurstTransport() {
+  flush();
+  {
+    std::lock_guard lock(mutex);
+    running = false;
+  }
+  queued.notify_one();
+  scheduler.join();
+#ifdef __linux__
+  if (timer_fd >= 0) ::close(timer_fd);
+#endif
+}
+
+PulseBurstTransport::Burst * PulseBurstTransport::take_burst() {
+  std::lock_guard lock(mutex);
+  if (!spare.empty()) {
+    auto * burst = spare.back();
+    spare.pop_back();
+    return burst;
+  }
+  // only while the number of groups in flight grows
+  bursts.push_back(std::make_unique<Burst>());
+  bursts.back()->packets.reserve(BurstPackets);
+  spare.reserve(bursts.size());
+  waiting.reserve(bursts.size());
+  return bursts.back().get();
+}
+
+int PulseBurstTransport::send(Packet packet) {
+  const auto * header = reinterpret_cast<const PacketHeaderV0 *>(packet->data);
+  if (current && (header->PulseHigh != pulse_high || header->PulseLow != pulse_low)) close_burst();
+  if (!current) {
+    current = take_burst();
+    pulse_high = header->PulseHigh;
+    pulse_low = header->PulseLow;
+    using namespace std::chrono;
+    const auto pulse = seconds(pulse_high) + nanoseconds(static_cast<uint64_t>(pulse_low) * 1000000000u / efu_time::ticks);
+    current->deadline = system_clock::time_point(duration_cast<system_clock::duration>(pulse + delay));
+  }
+  current->packets.push_back(std::move(packet));
+  std::lock_guard lock(mutex);
+  return std::exchange(error, 0);
+}
+
+void PulseBurstTransport::close_burst() {
+  {
+    std::lock_guard lock(mutex);
+    waiting.push_back(std::exchange(current, nullptr));
+    ++unreleased;
+  }
+  queued.notify_one();
+}
+
+void PulseBurstTransport::end_pulse() {
+  if (current) close_burst();
+}
+
+int PulseBurstTransport::flush() {
+  if (current) close_burst();
+  std::unique_lock lock(mutex);
+  released.wait(lock, [this](){return unreleased == 0;});
+  return std::exchange(error, 0);
+}
+
+int PulseBurstTransport::idle() {
+  std::lock_guard lock(mutex);
+  return std::exchange(error, 0);
+}
+
+void PulseBurstTransport::wait_until(const std::chrono::system_clock::time_point deadline) const {
+#ifdef __linux__
+  if (timer_fd >= 0) {
+    using namespace std::chrono;
+    const auto since_epoch = duration_cast<nanoseconds>(deadline.time_since_epoch()).count();
+    itimerspec spec{};
+    spec.it_value.tv_sec = static_cast<time_t>(since_epoch / 1000000000);
+    spec.it_value.tv_nsec = static_cast<long>(since_epoch % 1000000000);
+    // a deadline in the past expires immediately
+    if (::timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == 0) {
+      uint64_t expirations;
+      while (::read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno == EINTR);
+      return;
+    }
+  }
+#endif
+  std::this_thread::sleep_until(deadline);
+}
+
+void PulseBurstTransport::run() {
+  while (true) {
+    Burst * burst;
+    {
+      std::unique_lock lock(mutex);
+      queued.wait(lock, [this](){return !waiting.empty() || !running;});
+      if (waiting.empty()) return;
+      // rarely more than one or two groups wait, so shifting the rest costs less than a ring
+      burst = waiting.front();
+      waiting.erase(waiting.begin());
+    }
+    wait_until(burst->deadline);
+    const auto lateness = std::chrono::system_clock::now() - burst->deadline;
+    if (lateness > Tolerance) ++late;
+    const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(lateness).count();
+    if (nanoseconds > worst) worst = nanoseconds;
+    int error_code{0};
+    for (auto & packet: burst->packets) {
+      if (auto e = inner->send(std::move(packet))) error_code = e;
+    }
+    if (auto e = inner->flush()) error_code = e;
+    // keeps its capacity for reuse
+    burst->packets.clear();
+    {
+      std::lock_guard lock(mutex);
+      if (error_code) error = error_code;
+      spare.push_back(burst);
+      --unreleased;
+    }
+    released.notify_all();
+  }
+}
+
+std::unique_ptr<Transport> make_transport(const readout_transport type, const std::string & address, const uint16_t port, const size_t batch) {
+  switch (type) {
+#ifdef __linux__
+    case READOUT_TRANSPORT_SENDMMSG: return std::make_unique<MMsgTransport>(address, port, batch);
+    case READOUT_TRANSPORT_GSO: return std::make_unique<GSOTransport>(address, port, batch);
+#endif
+#ifdef READOUT_HAS_IO_URING
+    case READOUT_TRANSPORT_URING:
+      try {
+        return std::make_unique<UringTransport>(address, port, batch);
+      } catch (const std::runtime_error &) {
+        // e.g., io_uring disabled by the kernel or a container security policy
+        return std::make_unique<UDPTransport>(address, port);
+      }
+#endif
+    default:
+      // the default, and the fallback for backends not available on this platform
+      (void) batch;
+      return std::make_unique<UDPTransport>(address, port);
+  }
+}
@@ -0,0 +1,351 @@
+// Copyright (C) 2022 European Spallation Source, ERIC. See LICENSE file
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Packet transmission backends used by the readout generator class
+///
+//===----------------------------------------------------------------------===//
+#pragma once
+
+#include "cluon-complete.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+#ifdef __linux__
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define READOUT_HAS_IO_URING
+#endif
+#endif
+
+#include "Readout.h"
+#include "packet_pool.h"
+#include "pacer.h"
+
+/// \brief Socket options used when the destination is an IPv4 multicast group
+struct MulticastOptions {
+  int ttl{1};                     ///< Number of router hops the packets may make
+  std::string interface_address;  ///< IPv4 address of the sending interface, or empty for the system default
+  bool loop{true};                ///< Whether packets are also delivered to group members on this host
+};
+
+/** \brief Destination for complete ESS readout packets
+ *
+ * Implementations take ownership of each packet buffer and send straight from it, returning it to its pool
+ * once the kernel no longer needs it. They may send each packet immediately, or queue packets and send
+ * several at once, in which case flush() must be used to force out any queued packets.
+ */
+class Transport {
+public:
+  static constexpr size_t MaxPacketSize{PacketBuffer::Capacity};
+
+  virtual ~Transport() = default;
+  /// \brief Send, or queue for sending, one packet of packet->size bytes. Returns 0 or an errno value
+  virtual int send(Packet packet) = 0;
+  /// \brief Send any queued packets. Returns 0 or an errno value
+  virtual int flush() {return 0;}
+  /// \brief Send any packets queued for batching, without waiting for those held back until a later time
+  virtual int idle() {return flush();}
+  /// \brief The pulse time has rolled over, so no more packets of the pulse in the last packet header will follow
+  virtual void end_pulse() {}
+  /// \brief The readout_transport value identifying this backend
+  [[nodiscard]] virtual readout_transport type() const = 0;
+  /// \brief The number of packets discarded rather than sent
+  [[nodiscard]] virtual size_t dropped() const {return 0;}
+  /// \brief The most packets this backend holds on to at once
+  [[nodiscard]] virtual size_t capacity() const {return 0;}
+  /// \brief The total time spent holding packets back to limit the transmission rate
+  [[nodiscard]] virtual std::chrono::nanoseconds throttled() const {return std::chrono::nanoseconds(0);}
+  /// \brief The number of pulse bursts which could not be released on time
+  [[nodiscard]] virtual size_t missed() const {return 0;}
+  /// \brief Apply multicast socket options. Returns 0 or an errno value
+  virtual int set_multicast(const MulticastOptions &) {return ENOTSUP;}
+};
+
+#ifndef _WIN32
+/// \brief Common parts of the backends which manage their own UDP socket
+class SocketTransport: public Transport {
+protected:
+  int socket_fd{-1};
+  sockaddr_in destination{};
+  /// \brief Send a single datagram immediately. Returns 0 or an errno value
+  int send_to(const char * data, size_t size) const;
+public:
+  SocketTransport(const std::string & address, uint16_t port);
+  ~SocketTransport() override;
+  SocketTransport(const SocketTransport &) = delete;
+  SocketTransport & operator=(const SocketTransport &) = delete;
+  int set_multicast(const MulticastOptions & options) override;
+};
+
+/// \brief One sendto system call per packet
+class UDPTransport: public SocketTransport {
+public:
+  UDPTransport(const std::string & address, const uint16_t port): SocketTransport(address, port) {}
+  int send(Packet packet) override;
+  [[nodiscard]] readout_transport type() const override {return READOUT_TRANSPORT_UDP;}
+};
+#else
+/// \brief One send per packet via cluon, which needs a copy of the packet in a std::string
+class UDPTransport: public Transport {
+  cluon::UDPSender sender;
+public:
+  UDPTransport(const std::string & address, const uint16_t port): sender{address, port} {}
+  int send(Packet packet) override;
+  [[nodiscard]] readout_transport type() const override {return READOUT_TRANSPORT_UDP;}
+};
+#endif
+
+#ifdef __linux__
+/// \brief Queue up to `batch` packets and submit them in a single sendmmsg system call
+class MMsgTransport: public SocketTransport {
+  size_t batch;
+  size_t queued{0};
+  std::vector<Packet> packets;
+  std::vector<iovec> vectors;
+  std::vector<mmsghdr> messages;
+public:
+  MMsgTransport(const std::string & address, uint16_t port, size_t batch);
+  ~MMsgTransport() override;
+  int send(Packet packet) override;
+  int flush() override;
+  [[nodiscard]] readout_transport type() const override {return READOUT_TRANSPORT_SENDMMSG;}
+  [[nodiscard]] size_t capacity() const override {return batch;}
+};
+
+/** \brief Coalesce consecutive equal-size packets and let the kernel split them (UDP generic segmentation offload)
+ *
+ * Full packets of one readout type all have the same size, so up to `batch` of them are gathered and
+ * handed to the kernel in one sendmsg call with the UDP_SEGMENT size set to the packet size.
+ * A shorter packet may end a burst, a longer one starts a new burst.
+ * If the kernel refuses segmentation offload (EIO, EINVAL or EOPNOTSUPP) every packet is sent on its own from
+ * then on; other errors, e.g. ENOBUFS, only lose the burst.
+ */
+class GSOTransport: public SocketTransport {
+  static constexpr size_t MaxSegments{64};
+  static constexpr size_t MaxBurstSize{65507}; // maximum IPv4 UDP payload
+  size_t batch;
+  size_t segment{0};
+  size_t queued{0};
+  size_t used{0};
+  bool offload{true};
+  std::vector<Packet> packets;
+  std::vector<iovec> vectors;
+  int send_queue();
+public:
+  GSOTransport(const std::string & address, uint16_t port, size_t batch);
+  ~GSOTransport() override;
+  int send(Packet packet) override;
+  int flush() override;
+  [[nodiscard]] readout_transport type() const override {return READOUT_TRANSPORT_GSO;}
+  [[nodiscard]] size_t capacity() const override {return batch;}
+  /// \brief Whether the kernel accepted segmentation offload, so far
+  [[nodiscard]] bool offloading() const {return offload;}
+};
+
+#ifdef READOUT_HAS_IO_URING
+/** \brief Submit packets to an io_uring without waiting for the kernel to send them
+ *
+ * Each packet occupies one of `depth` slots while the kernel sends it. Queued packets are submitted together, in
+ * one system call, once `depth` of them wait or on flush(); entries the kernel did not take are submitted again
+ * with the next call. Completions are only harvested when a free slot is needed or on flush(), and a packet is
+ * released only after the kernel reports it has finished with it.
+ * Construction throws std::runtime_error if the kernel does not provide io_uring.
+ */
+class UringTransport: public SocketTransport {
+  struct Slot {
+    Packet packet;
+    iovec vector;
+    msghdr message;
+  };
+  int ring_fd{-1};
+  void * sq_ring{nullptr};
+  void * cq_ring{nullptr};
+  size_t sq_ring_size{0};
+  size_t cq_ring_size{0};
+  io_uring_sqe * sqes{nullptr};
+  size_t sqes_size{0};
+  unsigned * sq_tail{nullptr};
+  unsigned * sq_mask{nullptr};
+  unsigned * sq_array{nullptr};
+  unsigned * cq_head{nullptr};
+  unsigned * cq_tail{nullptr};
+  unsigned * cq_mask{nullptr};
+  io_uring_cqe * cqes{nullptr};
+  std::vector<Slot> slots;
+  std::vector<unsigned> free_slots;
+  // packets submitted together, packets in slots, and those of them not yet taken by the kernel
+  unsigned batch{1};
+  unsigned in_flight{0};
+  unsigned unsubmitted{0};
+  int last_error{0};
+  // submit every waiting entry, and wait for `min_complete` completions if they were all taken
+  int enter(unsigned min_complete, unsigned flags);
+  void harvest();
+public:
+  UringTransport(const std::string & address, uint16_t port, size_t depth);
+  ~UringTransport() override;
+  int send(Packet packet) override;
+  int flush() override;
+  [[nodiscard]] readout_transport type() const override {return READOUT_TRANSPORT_URING;}
+  [[nodiscard]] size_t capacity() const override {return slots.size();}
+};
+#endif
+#endif
+
+/** \brief Hand packets to a dedicated thread which passes them on to another backend
+ *
+ * Packets are passed through a lock-free single-producer single-consumer ring of `depth` slots,
+ * so nothing but the hand-over happens on the calling thread. When the ring is full the caller either waits for the
+ * sender thread, discards the packet, or queues it in an (allocating) overflow list which is drained in order.
+ * Whenever the sender thread runs out of packets the wrapped backend sends what it holds for batching, while
+ * flush() also waits for any it holds back; destruction sends every packet still in the ring before the thread
+ * is stopped. The end of a pulse is passed on once every packet pushed before it has been handed over.
+ */
+class ThreadedTransport: public Transport {
+  std::unique_ptr<Transport> inner;
+  readout_full_ring policy;
+  std::vector<Packet> ring;
+  // consumer position, producer position, and total packets queued in the ring or overflow list
+  std::atomic<size_t> head{0};
+  std::atomic<size_t> tail{0};
+  std::atomic<size_t> pushed{0};
+  // flushes asked for, and those the sender thread has completed
+  std::atomic<size_t> flush_requests{0};
+  std::atomic<size_t> flushes{0};
+  // the number of packets pushed when the pulse last ended
+  std::atomic<size_t> pulse_ends{0};
+  std::mutex overflow_mutex;
+  std::deque<Packet> overflow;
+  std::atomic<size_t> overflowing{0};
+  std::atomic<size_t> discarded{0};
+  std::atomic<int> error{0};
+  std::atomic<bool> running{true};
+  // bumped after every push, and on destruction, to wake the sender thread
+  std::atomic<uint32_t> wakeups{0};
+  std::thread sender;
+  void run();
+public:
+  ThreadedTransport(std::unique_ptr<Transport> inner, size_t depth, readout_full_ring policy);
+  ~ThreadedTransport() override;
+  int send(Packet packet) override;
+  int flush() override;
+  void end_pulse() override;
+  [[nodiscard]] readout_transport type() const override {return inner->type();}
+  [[nodiscard]] size_t dropped() const override {return discarded + inner->dropped();}
+  // the ring, the packet being handed to the wrapped backend, and those it holds (the overflow list is not counted)
+  [[nodiscard]] size_t capacity() const override {return ring.size() + 1 + inner->capacity();}
+  [[nodiscard]] std::chrono::nanoseconds throttled() const override {return inner->throttled();}
+  [[nodiscard]] size_t missed() const override {return inner->missed();}
+};
+
+/** \brief Limit the rate at which packets are passed on to another backend
+ *
+ * The rate is either in readouts per second, counted from the packet size and `readout_size`,
+ * or in (UDP payload) bytes per second. A queueing backend may still send its queue in one go,
+ * so the burst allowance should cover its batch.
+ */
+class PacedTransport: public Transport {
+  std::unique_ptr<Transport> inner;
+  readout_pacing unit;
+  size_t readout_size;
+  Pacer pacer;
+  // written by the sending thread, which need not be the one reading it
+  std::atomic<int64_t> waited{0};
+public:
+  PacedTransport(std::unique_ptr<Transport> inner, readout_pacing unit, double rate, double burst, size_t readout_size);
+  int send(Packet packet) override;
+  int flush() override {return inner->flush();}
+  int idle() override {return inner->idle();}
+  void end_pulse() override {inner->end_pulse();}
+  [[nodiscard]] readout_transport type() const override {return inner->type();}
+  [[nodiscard]] size_t dropped() const override {return inner->dropped();}
+  [[nodiscard]] size_t capacity() const override {return inner->capacity();}
+  [[nodiscard]] std::chrono::nanoseconds throttled() const override {return std::chrono::nanoseconds(waited.load());}
+  [[nodiscard]] size_t missed() const override {return inner->missed();}
+};
+
+/** \brief Release the packets of each source pulse together, at a fixed delay after the pulse time
+ *
+ * Packets are grouped by the pulse time in their header. Once the pulse ends, or a packet of a later pulse arrives,
+ * the group is handed to a scheduler thread, which waits until the pulse time plus `delay` on the system
+ * (wall) clock -- with an absolute timerfd on Linux -- and then passes the whole group on to another backend.
+ * When pulse times follow the system clock a pulse only ends once the next begins, so `delay` should be at
+ * least one pulse period. A group released more than `Tolerance` after its deadline counts as missed.
+ * Groups, and the capacity of their packet lists, are reused so steady-state sending does not allocate;
+ * only flush() waits for the groups to be released.
+ */
+class PulseBurstTransport: public Transport {
+public:
+  static constexpr std::chrono::microseconds Tolerance{1000};
+private:
+  // packets reserved for each new group, which grows as needed
+  static constexpr size_t BurstPackets{64};
+  struct Burst {
+    std::chrono::system_clock::time_point deadline;
+    std::vector<Packet> packets;
+  };
+  std::unique_ptr<Transport> inner;
+  std::chrono::nanoseconds delay;
+  // the group being filled, if any, only used by the producer
+  Burst * current{nullptr};
+  uint32_t pulse_high{0};
+  uint32_t pulse_low{0};
+  // every group made so far, those free for reuse, and those waiting for their deadline in order;
+  // the lists have room for every group
+  std::mutex mutex;
+  std::condition_variable queued;
+  std::condition_variable released;
+  std::vector<std::unique_ptr<Burst>> bursts;
+  std::vector<Burst *> spare;
+  std::vector<Burst *> waiting;
+  // groups waiting for their deadline, or being released
+  size_t unreleased{0};
+  bool running{true};
+  int error{0};
+  std::atomic<size_t> late{0};
+  std::atomic<int64_t> worst{0};
+  int timer_fd{-1};
+  std::thread scheduler;
+  Burst * take_burst();
+  void close_burst();
+  void wait_until(std::chrono::system_clock::time_point deadline) const;
+  void run();
+public:
+  PulseBurstTransport(std::unique_ptr<Transport> inner, std::chrono::nanoseconds delay);
+  ~PulseBurstTransport() override;
+  int send(Packet packet) override;
+  int flush() override;
+  // released groups are flushed by the scheduler thread, so there is nothing to send before their deadline
+  int idle() override;
+  void end_pulse() override;
+  [[nodiscard]] readout_transport type() const override {return inner->type();}
+  [[nodiscard]] size_t dropped() const override {return inner->dropped();}
+  [[nodiscard]] size_t capacity() const override {return inner->capacity();}
+  [[nodiscard]] std::chrono::nanoseconds throttled() const override {return inner->throttled();}
+  [[nodiscard]] size_t missed() const override {return late + inner->missed();}
+  /// \brief The latest any group was released after its deadline
+  [[nodiscard]] std::chrono::nanoseconds worst_lateness() const {return std::chrono::nanoseconds(worst.load());}
+};
+
+/** \brief Construct the requested transmission backend
+ *
+ * @param type The requested backend, the default UDP backend is returned if it is not available on this platform
+ * @param address The IP address (or FQDN) of the EFU to receive
+ * @param port The UDP port at which the EFU is listening
+ * @param batch The maximum number of packets sent per system call, for backends which queue packets
+ */
+std::unique_ptr<Transport> make_transport(readout_transport type, const std::string & address, uint16_t port, size_t batch);
@@ -2,6 +2,8 @@
 #include <cstring>
 #include "ReadoutClass.h"
 #include "enums.h"
+#include "columns.h"
+#include "payload.h"
 
 
 #ifdef WIN32
@@ -75,21 +77,40 @@ public:
     dataset->createAttribute("readout", readoutType_name(readout));
   }
 
-  RL_API void saveReadout(const uint8_t Ring, const uint8_t FEN, const double tof, const double weight, const void * data){
+  // Save one readout, with its payload type (and so file event type) known at compile time
+  template<class Payload> void saveReadout(const uint8_t Ring, const uint8_t FEN, const double tof, const double weight, const Payload & data){
     if (!dataset.has_value()){
       if (verbosity > 1) std::cout << "No readout saved to file due to no dataset available" << std::endl;
       return;
     }
+    saveReadout(typename payload_traits<Payload>::event(Ring, FEN, tof, weight, &data));
+  }
+
+  RL_API void saveReadouts(const size_t count, const uint8_t * Ring, const uint8_t * FEN, const double * tof, const double * weight, const void * columns){
+    if (!dataset.has_value()){
+      if (verbosity > 1) std::cout << "No readouts saved to file due to no dataset available" << std::endl;
+      return;
+    }
     const auto type = readoutType_from_detectorType(detector);
     switch (type) {
-      case ReadoutType::CAEN: return saveReadout(CAEN_event(Ring, FEN, tof, weight, static_cast<const CAEN_readout_t*>(data)));
-      case ReadoutType::TTLMonitor: return saveReadout(TTLMonitor_event(Ring, FEN, tof, weight, static_cast<const TTLMonitor_readout_t*>(data)));
-      case ReadoutType::DREAM: return saveReadout(DREAM_event(Ring, FEN, tof, weight, static_cast<const DREAM_readout_t*>(data)));
-      case ReadoutType::VMM3: return saveReadout(VMM3_event(Ring, FEN, tof, weight, static_cast<const VMM3_readout_t*>(data)));
+      case ReadoutType::CAEN: return saveReadouts(events_from_columns<CAEN_event>(count, Ring, FEN, tof, weight, static_cast<const CAEN_columns_t*>(columns)));
+      case ReadoutType::TTLMonitor: return saveReadouts(events_from_columns<TTLMonitor_event>(count, Ring, FEN, tof, weight, static_cast<const TTLMonitor_columns_t*>(columns)));
+      case ReadoutType::DREAM: return saveReadouts(events_from_columns<DREAM_event>(count, Ring, FEN, tof, weight, static_cast<const DREAM_columns_t*>(columns)));
+      case ReadoutType::VMM3: return saveReadouts(events_from_columns<VMM3_event>(count, Ring, FEN, tof, weight, static_cast<const VMM3_columns_t*>(columns)));
       default: throw std::runtime_error("This readout data type not implemented yet!");
     }
   }
 
+  template<class T> void saveReadouts(const std::vector<T> & data){
+    if (file.has_value() and dataset.has_value() and !data.empty()) {
+      auto & ds = dataset.value();
+      // grow the 1-D dataset once for the whole block of events
+      auto pos = ds.getDimensions().back();
+      ds.resize({pos + data.size()});
+      ds.select({pos}, {data.size()}).write(data);
+    }
+  }
+
   template<class T> void saveReadout(T data){
     if (file.has_value() and dataset.has_value()) {
       auto & ds = dataset.value();
@@ -102,6 +123,17 @@ public:
   }
 
 private:
+  template<class T, class C>
+  static std::vector<T> events_from_columns(const size_t count, const uint8_t * Ring, const uint8_t * FEN, const double * tof, const double * weight, const C * columns){
+    std::vector<T> events;
+    events.reserve(count);
+    for (size_t i=0; i<count; ++i){
+      const auto row = readout_row(columns, i);
+      events.emplace_back(column_value(Ring, i), column_value(FEN, i), column_value(tof, i), column_value(weight, i), &row);
+    }
+    return events;
+  }
+
   HighFive::CompoundType hdf_compound_type() const {
     using namespace HighFive;
     switch (readout){
@@ -13,6 +13,8 @@ int main(int argc, char * argv[]){
   args::Group playback_type(parser, "Playback type (exclusive)", args::Group::Validators::Xor);
   args::Flag sequential_flag(playback_type, "sequential", "Replay events in order", {'s', "sequential"});
   args::Flag random_flag(playback_type, "random", "Replay events in random order", {'r', "random"});
+  args::ValueFlag<uint32_t> seed_flag(parser, "SEED", "Random seed for the replay order and event multiplicities, drawn from separate streams", {"seed"});
+  args::ValueFlag<std::string> timing_flag(parser, "TIMING", "Write the time spent in each stage of sending to this JSON file", {"timing"});
 
   args::Group number_group(parser, "Replay subset, FIRST and EVERY ignored if COUNT is not present", args::Group::Validators::DontCare);
   args::ValueFlag<int> count_flag(number_group, "COUNT", "Number of events to replay", {'n', "count"});
@@ -22,6 +24,9 @@ int main(int argc, char * argv[]){
   args::Group efu_group(parser, "Event Formation Unit connection", args::Group::Validators::DontCare);
   args::ValueFlag<std::string> address_flag(efu_group, "ADDR", "EFU IP address", {'a', "addr"});
   args::ValueFlag<int> port_flag(efu_group, "PORT", "EFU UDP port for accepting data", {'p', "port"});
+  args::ValueFlag<double> rate_flag(efu_group, "RATE", "Maximum readouts sent per second", {"rate"});
+  args::ValueFlag<double> burst_flag(efu_group, "BURST", "Readouts which may be sent back-to-back at RATE", {"burst"});
+  args::ValueFlag<double> pulse_events_flag(efu_group, "EVENTS", "Events per simulated source pulse, instead of following the system clock", {"pulse-events"});
 
   args::Positional<std::string> filename_positional(parser, "filename", "Filename to replay");
 
@@ -46,22 +51,31 @@ int main(int argc, char * argv[]){
   auto every = every_flag ? args::get(every_flag) : 1;
   auto address = address_flag ? args::get(address_flag) : "127.0.0.1";
   auto port = port_flag ? args::get(port_flag) : 9000;
+  auto rate = rate_flag ? args::get(rate_flag) : 0.;
+  auto burst = burst_flag ? args::get(burst_flag) : 0.;
+  auto seed = seed_flag ? args::get(seed_flag) : 0u;
+  auto timing = timing_flag ? args::get(timing_flag) : "";
+  auto pulse_events = pulse_events_flag ? args::get(pulse_events_flag) : 0.;
   auto filename = args::get(filename_positional);
 
   int choice{Replay::NONE};
   if (sequential_flag) choice |= SEQUENTIAL;
   if (random_flag) choice |= RANDOM;
 
+  double throttled;
   if (count) {
     if (verbose){
       std::cout << "Replaying " << count << " events from " << filename << " to " << address << ":" << port << std::endl;
     }
-    replay_subset(filename, address, port, first, count, every, choice);
+    throttled = replay_subset(filename, address, port, first, count, every, choice, rate, burst, seed, timing, pulse_events);
   } else {
     if (verbose){
       std::cout << "Replaying all events from " << filename << " to " << address << ":" << port << std::endl;
     }
-    replay_all(filename, address, port, choice);
+    throttled = replay_all(filename, address, port, choice, rate, burst, seed, timing, pulse_events);
+  }
+  if (verbose && rate > 0){
+    std::cout << "Held back for " << throttled << " s to keep to " << rate << " readouts per second" << std::endl;
   }
   return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,66 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+
+#include <Readout.h>
+#include <Structs.h>
+#include "test_utils.h"
+
+// Count every (non-aligned) allocation made by the process, including those made by the library
+namespace {
+  std::atomic<size_t> allocations{0};
+}
+
+void * operator new(std::size_t size) {
+  ++allocations;
+  if (auto ptr = std::malloc(size ? size : 1)) return ptr;
+  throw std::bad_alloc();
+}
+void * operator new[](std::size_t size) {
+  ++allocations;
+  if (auto ptr = std::malloc(size ? size : 1)) return ptr;
+  throw std::bad_alloc();
+}
+void operator delete(void * ptr) noexcept {std::free(ptr);}
+void operator delete[](void * ptr) noexcept {std::free(ptr);}
+void operator delete(void * ptr, std::size_t) noexcept {std::free(ptr);}
+void operator delete[](void * ptr, std::size_t) noexcept {std::free(ptr);}
+
+TEST_CASE("Steady-state sending does not allocate","[c][CAEN][transport][allocation]"){
+  // the sender thread (-1), pulse bursts (-2), and both (-3) are tested with the default transport, which they wrap
+  const auto requested = GENERATE(as<int>{}, READOUT_TRANSPORT_UDP, READOUT_TRANSPORT_SENDMMSG, READOUT_TRANSPORT_GSO,
+                                  READOUT_TRANSPORT_URING, -1, -2, -3);
+  const int count{100000};
+  char addr[] = "127.0.0.1";
+  // nothing listens at this port, which is fine for UDP
+  auto detector_efu = readout_create(addr, find_port(), 8888, 1 / 14., 0x34);
+  readout_silent(detector_efu);
+  if (requested == -1 || requested == -3) readout_set_sender_thread(detector_efu, 8, READOUT_FULL_RING_BLOCK);
+  const bool bursts = requested == -2 || requested == -3;
+  if (bursts) {
+    // simulated pulses from long ago, so each burst is due as soon as its pulse ends
+    readout_enable_pulse_bursts(detector_efu, 0.);
+    readout_set_clock(detector_efu, READOUT_CLOCK_EVENTS, 1000.);
+    readout_set_pulse_reference(detector_efu, 1, 0, 0, 0);
+  }
+  if (requested >= 0) readout_set_transport(detector_efu, requested, 8, 0);
+  CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+  auto add = [&](){
+    for (int i = 0; i < count; ++i) {
+      caen_data.a = static_cast<uint16_t>(i);
+      readout_add(detector_efu, 1, 0, static_cast<double>(i) / count, 0., &caen_data);
+      // a source releases its pulses no faster than they are made, so the bursts in flight stay bounded
+      if (bursts && i % 1000 == 999) readout_send(detector_efu);
+    }
+  };
+  // warm up, then every packet buffer should come from the pool
+  add();
+  const auto before = allocations.load();
+  add();
+  readout_send(detector_efu);
+  const auto after = allocations.load();
+  readout_destroy(detector_efu);
+  REQUIRE(after == before);
+}
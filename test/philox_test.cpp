@@ -0,0 +1,72 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <vector>
+
+#include <Readout.h>
+#include <philox.h>
+#include <poisson.h>
+#include "test_utils.h"
+
+TEST_CASE("Philox4x32-10 reproduces the Random123 known answers","[philox]"){
+  using block = std::array<uint32_t, 4>;
+  using key = std::array<uint32_t, 2>;
+  REQUIRE(Philox4x32::bijection(block{0, 0, 0, 0}, key{0, 0}) == block{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8});
+  REQUIRE(Philox4x32::bijection(block{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, key{0xffffffff, 0xffffffff})
+          == block{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd});
+  REQUIRE(Philox4x32::bijection(block{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, key{0xa4093822, 0x299f31d0})
+          == block{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1});
+}
+
+TEST_CASE("Philox streams are reproducible and independent","[philox]"){
+  auto draw = [](Philox4x32 & engine, size_t count){
+    std::vector<uint32_t> numbers(count);
+    for (auto & number: numbers) number = engine();
+    return numbers;
+  };
+  Philox4x32 first{7, 1}, again{7, 1}, other_stream{7, 2}, other_substream{7, 1, 1};
+  const auto numbers = draw(first, 10);
+  REQUIRE(numbers == draw(again, 10));
+  REQUIRE(numbers != draw(other_stream, 10));
+  REQUIRE(numbers != draw(other_substream, 10));
+
+  // the numbers for an event do not depend on what was drawn before
+  Philox4x32 busy{7, 1, 3}, idle{7, 1};
+  draw(busy, 13);
+  busy.seek_event(1000);
+  idle.seek_event(1000);
+  REQUIRE(draw(busy, 10) == draw(idle, 10));
+  // nor are they those of a substream, even for the first event
+  Philox4x32 fresh{7, 1}, event{7, 1};
+  event.seek_event(0);
+  REQUIRE(draw(event, 10) != draw(fresh, 10));
+  // and stay apart after re-seeding
+  event.seek_event(0);
+  event.seed(7);
+  Philox4x32 reseeded{7, 1};
+  REQUIRE(draw(event, 10) != draw(reseeded, 10));
+
+  // the Poisson sampler accepts it as its engine
+  Philox4x32 engine{1};
+  int total{0};
+  for (int i = 0; i < 10000; ++i) total += PoissonSampler::sample(engine, 1.);
+  REQUIRE(total > 9000);
+  REQUIRE(total < 11000);
+}
+
+TEST_CASE("Readout multiplicities for an event are reproducible","[c][philox]"){
+  char addr[] = "127.0.0.1";
+  auto first = readout_create(addr, find_port(), 8888, 14., 0x34);
+  auto second = readout_create(addr, find_port(), 8888, 14., 0x34);
+  readout_rand_seed(first, 99);
+  readout_rand_seed(second, 99);
+  readout_rand_stream(first, 3);
+  readout_rand_stream(second, 3);
+  // the second object has drawn other numbers before
+  for (int i = 0; i < 17; ++i) readout_rand_poisson(second, 2.);
+  readout_rand_event(first, 123456789012u);
+  readout_rand_event(second, 123456789012u);
+  for (int i = 0; i < 100; ++i) REQUIRE(readout_rand_poisson(first, 2.) == readout_rand_poisson(second, 2.));
+  readout_destroy(first);
+  readout_destroy(second);
+}
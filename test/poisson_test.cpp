@@ -0,0 +1,62 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <poisson.h>
+
+TEST_CASE("Sampled multiplicities have the Poisson mean and variance","[poisson]"){
+  const auto mean = GENERATE(0.001, 0.1, 1., 5., 15., 40.);
+  const int count{200000};
+  std::mt19937 engine{12345u};
+  double sum{0}, squares{0};
+  for (int i = 0; i < count; ++i) {
+    const auto k = static_cast<double>(PoissonSampler::sample(engine, mean));
+    sum += k;
+    squares += k * k;
+  }
+  const auto sample_mean = sum / count;
+  const auto sample_variance = squares / count - sample_mean * sample_mean;
+  // five standard errors of the sample mean, and roughly of the sample variance
+  REQUIRE(std::abs(sample_mean - mean) < 5 * std::sqrt(mean / count));
+  REQUIRE(std::abs(sample_variance - mean) < 5 * std::sqrt((mean + 2 * mean * mean) / count));
+}
+
+TEST_CASE("Batched multiplicities match one-by-one sampling","[poisson]"){
+  std::vector<double> means{0., 0.5, 1e-6, 3., 0.02, 20., -1., 7.5};
+  for (int i = 0; i < 200; ++i) means.push_back(0.01 * i);
+  std::vector<int> batched(means.size());
+  std::mt19937 batch_engine{42u}, single_engine{42u};
+  PoissonSampler::sample(batch_engine, means.size(), means.data(), batched.data());
+  for (size_t i = 0; i < means.size(); ++i) REQUIRE(batched[i] == PoissonSampler::sample(single_engine, means[i]));
+  REQUIRE(batched[0] == 0);
+  REQUIRE(batched[6] == 0);
+}
+
+TEST_CASE("Poisson multiplicity sampling","[.][benchmark][poisson]"){
+  // typical McStas ray weights are well below one
+  std::vector<double> means(4096);
+  std::mt19937 weights{1u};
+  std::exponential_distribution<double> weight(10.);
+  for (auto & m: means) m = weight(weights);
+  std::vector<int> out(means.size());
+  std::mt19937 engine{2u};
+
+  BENCHMARK("std::poisson_distribution per event"){
+    int total{0};
+    for (const auto m: means) total += std::poisson_distribution<int>(m)(engine);
+    return total;
+  };
+  BENCHMARK("PoissonSampler per event"){
+    int total{0};
+    for (const auto m: means) total += PoissonSampler::sample(engine, m);
+    return total;
+  };
+  BENCHMARK("PoissonSampler batched"){
+    PoissonSampler::sample(engine, means.size(), means.data(), out.data());
+    return out.back();
+  };
+}
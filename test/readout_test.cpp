@@ -1,9 +1,23 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
 #include "cluon-complete.hpp"
 
+#include <algorithm>
+#include <condition_variable>
+#include <array>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
 #include <Readout.h>
 #include <Structs.h>
+#include <efu_time.h>
+#include <log.h>
+#include <shared_ring.h>
+#include <transport.h>
 #include "test_utils.h"
 
 #ifdef _WIN32
@@ -203,4 +217,898 @@ TEST_CASE("Send and receive TTLMonitor packets","[c]"){
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
   }
   REQUIRE(stats->readouts == expected);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Send and receive VMM3 packets via the typed entry point","[c][VMM3]"){
+  const uint16_t max{1000};
+  uint32_t freia_type{0x48};
+  int freia_port = find_port();
+  auto stats = std::make_shared<UDPStats>();
+
+  cluon::UDPReceiver freia_receiver("127.0.0.1", freia_port,
+    [stats,freia_type](std::string && data, std::string &&, std::chrono::system_clock::time_point &&) noexcept {
+      auto ptr = data.data();
+      auto * header = reinterpret_cast<PacketHeaderV0*>(ptr);
+      REQUIRE(freia_type == (header->CookieAndType >> 24));
+      ptr += sizeof(PacketHeaderV0);
+      size_t readout_size = sizeof(struct VMM3Data);
+      auto readouts = (header->TotalLength - sizeof(PacketHeaderV0)) / readout_size;
+      for (size_t i=0; i < readouts; ++i){
+        auto *r = reinterpret_cast<VMM3Data *>(ptr + i * readout_size);
+        REQUIRE(r->Ring == 2);
+        REQUIRE(r->FEN == 5);
+        REQUIRE(r->Length == readout_size);
+        REQUIRE(r->BC == stats->readouts + i);
+        REQUIRE(r->VMM == 7);
+        REQUIRE(r->Channel == 63);
+      }
+      stats->packets++;
+      stats->readouts += readouts;
+    });
+  REQUIRE(freia_receiver.isRunning());
+
+  {
+    char addr[] = "127.0.0.1";
+    auto freia_efu = readout_create(addr, freia_port, 8889, 1 / 14., static_cast<int>(freia_type));
+    VMM3_readout_t vmm3_data{0, 100, 1, 2, 7, 63};
+    for (uint16_t i = 0; i < max; ++i) {
+      vmm3_data.bc = i;
+      REQUIRE(readout_add_vmm3(freia_efu, 2, 5, static_cast<double>(i) / static_cast<double>(max), 0.0, &vmm3_data) == 0);
+    }
+    // a payload of another type is rejected, not sent
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    REQUIRE(readout_add_caen(freia_efu, 2, 5, 0., 0., &caen_data) == -1);
+    readout_destroy(freia_efu);
+  }
+  if (stats->readouts < max){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == max);
+}
+
+TEST_CASE("Batched readouts share packets within a pulse","[c][CAEN][batch]"){
+  const uint16_t max{1000};
+  uint32_t detector_type{0x34};
+
+  int detector_port = find_port();
+  auto stats = std::make_shared<CaenStats>();
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port, receive_caen(stats));
+  REQUIRE(detector_receiver.isRunning());
+
+  char addr[] = "127.0.0.1";
+  {
+    // a 1/14 Hz source keeps all events in the same pulse
+    auto detector_efu = readout_create(addr, detector_port, 8888, 1 / 14., static_cast<int>(detector_type));
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) {
+      caen_data.a = i;
+      readout_add(detector_efu, 1, 0, static_cast<double>(i) / static_cast<double>(max), 0., &caen_data);
+    }
+    readout_destroy(detector_efu);
+  }
+  if (stats->readouts < max){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == max);
+  // each jumbo packet holds a few hundred CAEN readouts, so only a handful of packets are needed
+  auto per_packet = (8950 - sizeof(PacketHeaderV0)) / sizeof(struct CaenData) + 1;
+  REQUIRE(stats->packets == static_cast<int>((max + per_packet - 1) / per_packet));
+}
+
+
+TEST_CASE("Send and receive a batch of CAEN readouts","[c][CAEN][batch]"){
+  const uint16_t max{1000};
+  uint32_t detector_type{0x34};
+
+  int detector_port = find_port();
+  auto stats = std::make_shared<CaenStats>();
+
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port,
+      receive_caen(stats, [](const PacketHeaderV0 &, const CaenData * caen, size_t readouts, const CaenStats & before){
+        for (size_t i=0; i<readouts; ++i){
+          const auto *r = caen + i;
+          REQUIRE(r->Ring == (before.readouts + i) % 3);
+          REQUIRE(r->FEN == 2);
+          REQUIRE(r->Length == sizeof(struct CaenData));
+          REQUIRE(r->Tube == 3);
+          REQUIRE(r->AmplA == before.readouts + i);
+          REQUIRE(r->AmplB == max - i - before.readouts);
+          REQUIRE(r->AmplC == 0);
+          REQUIRE(r->AmplD == 0);
+        }
+      }));
+  REQUIRE(detector_receiver.isRunning());
+
+  std::vector<uint8_t> ring(max), fen(max, 2), channel(max, 3);
+  std::vector<uint16_t> a(max), b(max);
+  std::vector<double> tof(max), weight(max, 0.);
+  for (uint16_t i = 0; i < max; ++i) {
+    ring[i] = static_cast<uint8_t>(i % 3);
+    a[i] = i;
+    b[i] = max - i;
+    tof[i] = static_cast<double>(i) / static_cast<double>(max);
+  }
+  // the c and d columns are omitted, and should be sent as zeros
+  CAEN_columns_t columns{channel.data(), a.data(), b.data(), nullptr, nullptr};
+
+  char addr[] = "127.0.0.1";
+  {
+    auto detector_efu = readout_create(addr, detector_port, 8888, 1 / 14., static_cast<int>(detector_type));
+    // split the events over two batches to check that packets continue between calls
+    readout_add_batch(detector_efu, max / 2, ring.data(), fen.data(), tof.data(), weight.data(), &columns);
+    const size_t half{max / 2};
+    CAEN_columns_t rest{channel.data() + half, a.data() + half, b.data() + half, nullptr, nullptr};
+    readout_add_batch(detector_efu, max - half, ring.data() + half, fen.data() + half, tof.data() + half, weight.data() + half, &rest);
+    readout_destroy(detector_efu);
+  }
+  if (stats->readouts < max){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == max);
+}
+
+
+TEST_CASE("Reserve and commit TTLMonitor readouts in place","[c][TTLMonitor][reserve]"){
+  const uint16_t max{1000};
+  uint32_t monitor_type{0x10};
+  int monitor_port = find_port();
+  auto stats = std::make_shared<UDPStats>();
+
+  cluon::UDPReceiver monitor_receiver("127.0.0.1", monitor_port,
+    [stats](std::string && data, std::string &&, std::chrono::system_clock::time_point &&) noexcept {
+      auto ptr = data.data();
+      auto * header = reinterpret_cast<PacketHeaderV0*>(ptr);
+      REQUIRE(header->TotalLength == data.size());
+      ptr += sizeof(PacketHeaderV0);
+      size_t readout_size = sizeof(struct TTLMonitorData);
+      auto readouts = (header->TotalLength - sizeof(PacketHeaderV0)) / readout_size;
+      for (size_t i=0; i < readouts; ++i){
+        auto *r = reinterpret_cast<TTLMonitorData *>(ptr + i * readout_size);
+        REQUIRE(r->Ring == 0);
+        REQUIRE(r->FEN == 100);
+        REQUIRE(r->Length == readout_size);
+        REQUIRE(r->Pos == 3);
+        REQUIRE(r->ADC == stats->readouts + i);
+      }
+      stats->packets++;
+      stats->readouts += readouts;
+    });
+  REQUIRE(monitor_receiver.isRunning());
+
+  {
+    char addr[] = "127.0.0.1";
+    auto monitor_efu = readout_create(addr, monitor_port, 8889, 1 / 14., static_cast<int>(monitor_type));
+    // the wrong readout kind can not be reserved
+    REQUIRE(readout_reserve_caen(monitor_efu, 0, 100, 0.) == nullptr);
+    for (uint16_t i = 0; i < max; ++i) {
+      auto * r = readout_reserve_ttlmonitor(monitor_efu, 0, 100, static_cast<double>(i) / static_cast<double>(max));
+      REQUIRE(r != nullptr);
+      r->Pos = 3;
+      r->Channel = 0;
+      r->ADC = i;
+      readout_commit(monitor_efu);
+    }
+    // a reservation which is never committed is not sent
+    readout_reserve_ttlmonitor(monitor_efu, 0, 100, 0.)->ADC = max;
+    readout_destroy(monitor_efu);
+  }
+  if (stats->readouts < max){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == max);
+}
+
+
+TEST_CASE("Send and receive CAEN packets via queueing transports","[c][CAEN][transport]"){
+  const auto requested = GENERATE(READOUT_TRANSPORT_SENDMMSG, READOUT_TRANSPORT_GSO, READOUT_TRANSPORT_URING);
+  const uint16_t max{5000};
+  uint32_t detector_type{0x34};
+
+  int detector_port = find_port();
+  auto stats = std::make_shared<CaenStats>();
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port,
+      receive_caen(stats, [](const PacketHeaderV0 &, const CaenData * caen, size_t readouts, const CaenStats & before){
+        for (size_t i=0; i<readouts; ++i) REQUIRE(caen[i].AmplA == before.readouts + i);
+      }));
+  REQUIRE(detector_receiver.isRunning());
+
+  char addr[] = "127.0.0.1";
+  {
+    auto detector_efu = readout_create(addr, detector_port, 8888, 1 / 14., static_cast<int>(detector_type));
+    REQUIRE(readout_set_transport(detector_efu, READOUT_TRANSPORT_URING + 1, 4, 0) == -1);
+    REQUIRE(readout_set_transport(nullptr, requested, 4, 0) == -1);
+    auto transport = readout_set_transport(detector_efu, requested, 4, 0);
+#ifdef __linux__
+    // io_uring may be disabled by the kernel configuration or a seccomp policy
+    REQUIRE((transport == requested || (requested == READOUT_TRANSPORT_URING && transport == READOUT_TRANSPORT_UDP)));
+#else
+    REQUIRE(transport == READOUT_TRANSPORT_UDP);
+#endif
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) {
+      caen_data.a = i;
+      readout_add(detector_efu, 1, 0, static_cast<double>(i) / static_cast<double>(max), 0., &caen_data);
+    }
+    readout_destroy(detector_efu);
+  }
+  if (stats->readouts < max){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == max);
+  // packets leave in order, with contiguous sequence numbers
+  REQUIRE(stats->out_of_order == 0);
+}
+
+TEST_CASE("Send and receive CAEN packets via the sender thread","[c][CAEN][transport]"){
+  const auto full_ring = GENERATE(READOUT_FULL_RING_BLOCK, READOUT_FULL_RING_GROW);
+  const uint16_t max{5000};
+  uint32_t detector_type{0x34};
+
+  int detector_port = find_port();
+  auto stats = std::make_shared<CaenStats>();
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port,
+      receive_caen(stats, [](const PacketHeaderV0 &, const CaenData * caen, size_t readouts, const CaenStats & before){
+        for (size_t i=0; i<readouts; ++i) REQUIRE(caen[i].AmplA == before.readouts + i);
+      }));
+  REQUIRE(detector_receiver.isRunning());
+
+  char addr[] = "127.0.0.1";
+  {
+    auto detector_efu = readout_create(addr, detector_port, 8888, 1 / 14., static_cast<int>(detector_type));
+    REQUIRE(readout_set_sender_thread(detector_efu, 2, -1) == -1);
+    // a shallow ring so that the full-ring policy is exercised
+    REQUIRE(readout_set_sender_thread(detector_efu, 2, full_ring) == 0);
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) {
+      caen_data.a = i;
+      readout_add(detector_efu, 1, 0, static_cast<double>(i) / static_cast<double>(max), 0., &caen_data);
+    }
+    REQUIRE(readout_dropped_packets(detector_efu) == 0);
+    readout_destroy(detector_efu);
+  }
+  if (stats->readouts < max){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == max);
+  REQUIRE(stats->out_of_order == 0);
+}
+
+TEST_CASE("A full sender thread ring drops packets and keeps sending","[transport][drop]"){
+  // a backend which holds the sender thread in send() until released
+  struct Gate {
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool open{false};
+    size_t entered{0};
+    size_t sent{0};
+  };
+  class Stalled: public Transport {
+    std::shared_ptr<Gate> gate;
+  public:
+    explicit Stalled(std::shared_ptr<Gate> gate): gate(std::move(gate)) {}
+    int send(Packet) override {
+      std::unique_lock lock(gate->mutex);
+      ++gate->entered;
+      gate->changed.notify_all();
+      gate->changed.wait(lock, [this](){return gate->open;});
+      ++gate->sent;
+      return 0;
+    }
+    [[nodiscard]] readout_transport type() const override {return READOUT_TRANSPORT_UDP;}
+  };
+  auto gate = std::make_shared<Gate>();
+  PacketPool pool;
+  auto packet = [&pool](){
+    auto p = pool.acquire();
+    p->size = sizeof(PacketHeaderV0);
+    return p;
+  };
+  {
+    ThreadedTransport transport(std::make_unique<Stalled>(gate), 2, READOUT_FULL_RING_DROP);
+    REQUIRE(transport.send(packet()) == 0);
+    {
+      // the sender thread is stuck with the first packet, so two more fill the ring and the rest are dropped
+      std::unique_lock lock(gate->mutex);
+      gate->changed.wait(lock, [&](){return gate->entered == 1;});
+    }
+    for (int i = 0; i < 9; ++i) REQUIRE(transport.send(packet()) == 0);
+    REQUIRE(transport.dropped() == 7);
+    {
+      std::lock_guard lock(gate->mutex);
+      gate->open = true;
+    }
+    gate->changed.notify_all();
+    REQUIRE(transport.flush() == 0);
+    REQUIRE(gate->sent == 3);
+    // the sender thread carries on once the backend is moving again
+    REQUIRE(transport.send(packet()) == 0);
+    REQUIRE(transport.flush() == 0);
+    REQUIRE(gate->sent == 4);
+    REQUIRE(transport.dropped() == 7);
+  }
+}
+
+TEST_CASE("Readout pacing limits the event rate","[c][CAEN][pacing]"){
+  const uint16_t max{20000};
+  const double rate{200000}; // readouts per second
+  const double burst{1000};
+  int detector_port = find_port();
+  auto stats = std::make_shared<CaenStats>();
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port, receive_caen(stats));
+  REQUIRE(detector_receiver.isRunning());
+
+  char addr[] = "127.0.0.1";
+  auto detector_efu = readout_create(addr, detector_port, 8888, 1 / 14., 0x34);
+  REQUIRE(readout_set_pacing(detector_efu, READOUT_PACING_BYTES + 1, rate, burst) == -1);
+  REQUIRE(readout_set_pacing(detector_efu, READOUT_PACING_EVENTS, rate, burst) == 0);
+  const auto start = std::chrono::steady_clock::now();
+  CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+  for (uint16_t i = 0; i < max; ++i) {
+    caen_data.a = i;
+    readout_add_caen(detector_efu, 1, 0, static_cast<double>(i) / static_cast<double>(max), 0., &caen_data);
+  }
+  readout_send(detector_efu);
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  const auto throttled = readout_throttled_time(detector_efu);
+  readout_destroy(detector_efu);
+  // all but the last packet are released at the limited rate, after the first burst
+  const auto per_packet = (8950 - sizeof(PacketHeaderV0)) / sizeof(struct CaenData) + 1;
+  const auto minimum = (max - burst - per_packet) / rate;
+  REQUIRE(elapsed.count() >= minimum);
+  REQUIRE(throttled > 0.);
+  REQUIRE(throttled <= elapsed.count());
+  if (stats->readouts < max){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == max);
+}
+
+TEST_CASE("Pulse bursts are released after their pulse time","[c][CAEN][burst]"){
+  const uint16_t max{2000};
+  const double frequency{100}; // a short period keeps the test quick
+  const auto delay = std::chrono::milliseconds(5);
+  int detector_port = find_port();
+  auto stats = std::make_shared<UDPStats>();
+  auto early = std::make_shared<std::atomic<int>>(0);
+
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port,
+      [stats,early,delay](std::string && data, std::string &&, std::chrono::system_clock::time_point && received) noexcept {
+        auto * header = reinterpret_cast<PacketHeaderV0*>(data.data());
+        using namespace std::chrono;
+        const auto pulse = seconds(header->PulseHigh) + nanoseconds(static_cast<uint64_t>(header->PulseLow) * 1000000000u / 88052499u);
+        if (received < system_clock::time_point(duration_cast<system_clock::duration>(pulse + delay))) (*early)++;
+        stats->packets++;
+        stats->readouts += static_cast<int>((header->TotalLength - sizeof(PacketHeaderV0)) / sizeof(struct CaenData));
+      });
+  REQUIRE(detector_receiver.isRunning());
+
+  char addr[] = "127.0.0.1";
+  {
+    auto detector_efu = readout_create(addr, detector_port, 8888, frequency, 0x34);
+    readout_enable_pulse_bursts(detector_efu, std::chrono::duration<double>(delay).count());
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) {
+      caen_data.a = i;
+      readout_add_caen(detector_efu, 1, 0, 0., 0., &caen_data);
+      // spread the readouts over several pulses
+      if (i % 100 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(3));
+    }
+    readout_destroy(detector_efu);
+  }
+  if (stats->readouts < max){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == max);
+  REQUIRE(stats->packets > 1);
+  REQUIRE(early->load() == 0);
+}
+
+TEST_CASE("Sharded readouts reach the destination for their ring","[c][CAEN][shard]"){
+  const uint16_t max{2000};
+  const int first_port = find_port();
+  auto first_stats = std::make_shared<CaenStats>();
+  cluon::UDPReceiver first_receiver("127.0.0.1", first_port, receive_caen(first_stats));
+  const int second_port = find_port();
+  auto second_stats = std::make_shared<CaenStats>();
+  cluon::UDPReceiver second_receiver("127.0.0.1", second_port, receive_caen(second_stats));
+  REQUIRE(first_receiver.isRunning());
+  REQUIRE(second_receiver.isRunning());
+
+  char addr[] = "127.0.0.1";
+  {
+    auto detector_efu = readout_create(addr, first_port, 8888, 1 / 14., 0x34);
+    REQUIRE(readout_add_destination(detector_efu, addr, second_port) == 1);
+    REQUIRE(readout_map_shard(detector_efu, 1, 1) == 0);
+    REQUIRE(readout_map_shard(detector_efu, 2, 2) == -1);
+    REQUIRE(readout_set_sharding(detector_efu, 3) == -1);
+    REQUIRE(readout_set_sharding(detector_efu, READOUT_SHARD_RING) == 0);
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) {
+      caen_data.a = i;
+      readout_add_caen(detector_efu, static_cast<uint8_t>(i % 2), 0, static_cast<double>(i) / max, 0., &caen_data);
+    }
+    readout_destroy(detector_efu);
+  }
+  if (first_stats->readouts + second_stats->readouts < max){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  for (const uint8_t ring: {0, 1}) {
+    auto & stats = ring ? second_stats : first_stats;
+    REQUIRE(stats->readouts == max / 2);
+    std::lock_guard lock(stats->mutex);
+    REQUIRE(stats->rings == std::map<uint8_t, int>{{ring, max / 2}});
+    // each destination numbers its own packets
+    REQUIRE(stats->out_of_order == 0);
+  }
+}
+
+TEST_CASE("Packets are spread over output queues","[c][CAEN][queue]"){
+  const auto policy = GENERATE(as<int>{}, READOUT_QUEUE_FEN, READOUT_QUEUE_ROUND_ROBIN);
+  const uint16_t max{5000};
+  const int queues{4};
+  int detector_port = find_port();
+  auto stats = std::make_shared<CaenStats>();
+  auto misrouted = std::make_shared<std::atomic<int>>(0);
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port,
+      receive_caen(stats, [policy, misrouted](const PacketHeaderV0 & header, const CaenData * caen, size_t readouts, const CaenStats &){
+        if (policy != READOUT_QUEUE_FEN) return;
+        for (size_t i = 0; i < readouts; ++i) if (caen[i].FEN % queues != header.OutputQueue) (*misrouted)++;
+      }));
+  REQUIRE(detector_receiver.isRunning());
+
+  char addr[] = "127.0.0.1";
+  {
+    auto detector_efu = readout_create(addr, detector_port, 8888, 1 / 14., 0x34);
+    REQUIRE(readout_set_output_queues(detector_efu, policy, 0) == -1);
+    REQUIRE(readout_set_output_queues(detector_efu, policy, queues) == 0);
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) {
+      caen_data.a = i;
+      readout_add_caen(detector_efu, 0, static_cast<uint8_t>(i % 8), static_cast<double>(i) / max, 0., &caen_data);
+    }
+    readout_destroy(detector_efu);
+  }
+  if (stats->readouts < max){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == max);
+  REQUIRE(*misrouted == 0);
+  // every queue is used, and numbers its own packets
+  std::lock_guard lock(stats->mutex);
+  REQUIRE(stats->queues.size() == static_cast<size_t>(queues));
+  REQUIRE(stats->queues.rbegin()->first == queues - 1);
+  REQUIRE(stats->out_of_order == 0);
+}
+
+TEST_CASE("Multicast packets reach every group member","[c][CAEN][multicast]"){
+  const uint16_t max{1000};
+  char group[] = "239.255.42.99";
+  int detector_port = find_port();
+  auto first = std::make_shared<CaenStats>();
+  auto second = std::make_shared<CaenStats>();
+  // both members join the group on the same port
+  cluon::UDPReceiver first_receiver(group, detector_port, receive_caen(first));
+  cluon::UDPReceiver second_receiver(group, detector_port, receive_caen(second));
+  REQUIRE(first_receiver.isRunning());
+  REQUIRE(second_receiver.isRunning());
+
+  {
+    auto detector_efu = readout_create(group, detector_port, 8888, 1 / 14., 0x34);
+    // stay on this host, and deliver to its group members
+    readout_set_multicast(detector_efu, 0, nullptr, 1);
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) {
+      caen_data.a = i;
+      readout_add_caen(detector_efu, 1, 0, static_cast<double>(i) / max, 0., &caen_data);
+    }
+    readout_destroy(detector_efu);
+  }
+  if (first->readouts < max || second->readouts < max){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(first->readouts == max);
+  REQUIRE(second->readouts == max);
+  REQUIRE(first->packets == second->packets);
+}
+
+TEST_CASE("Readouts added from several threads are all sent in sequence","[c][CAEN][threads]"){
+  const int threads{4};
+  const int per_thread{20000};
+  int detector_port = find_port();
+  auto stats = std::make_shared<CaenStats>();
+  // cluon calls back from a single thread, in the order the packets arrive
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port, receive_caen(stats));
+  REQUIRE(detector_receiver.isRunning());
+
+  char addr[] = "127.0.0.1";
+  {
+    auto detector_efu = readout_create(addr, detector_port, 8888, 1 / 14., 0x34);
+    readout_enable_multi_producer(detector_efu);
+    // nothing may be lost to a full socket buffer while the threads produce
+    readout_set_sender_thread(detector_efu, 1024, READOUT_FULL_RING_BLOCK);
+    std::vector<std::thread> producers;
+    for (int thread = 0; thread < threads; ++thread) {
+      producers.emplace_back([detector_efu, thread](){
+        CAEN_readout_t caen_data{static_cast<uint8_t>(thread), 0, 0, 0, 0};
+        for (int i = 0; i < per_thread; ++i) {
+          caen_data.a = static_cast<uint16_t>(i);
+          readout_add_caen(detector_efu, 1, 0, static_cast<double>(i) / per_thread, 0., &caen_data);
+          // keep the receiver from falling behind
+          if (i % 1000 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      });
+    }
+    for (auto & producer: producers) producer.join();
+    readout_destroy(detector_efu);
+  }
+  for (int wait = 0; wait < 10 && stats->readouts < threads * per_thread; ++wait){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == threads * per_thread);
+  REQUIRE(stats->out_of_order == 0);
+}
+
+TEST_CASE("A thread feeds more multi-producer objects than it remembers","[c][CAEN][threads]"){
+  const int objects{10};
+  const int per_object{100};
+  char addr[] = "127.0.0.1";
+  // nothing listens on the port
+  const int port = find_port();
+  std::vector<readout_t *> efus;
+  for (int i = 0; i < objects; ++i) {
+    efus.push_back(readout_create(addr, port, 8888, 1 / 14., 0x34));
+    readout_enable_multi_producer(efus.back());
+  }
+  CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+  // taking turns, so each object's staging state is found again after the others replaced it
+  for (int i = 0; i < per_object; ++i) for (auto * efu: efus) readout_add_caen(efu, 1, 0, 0., 0., &caen_data);
+  for (auto * efu: efus) {
+    readout_stats_t counters;
+    REQUIRE(readout_stats(efu, &counters) == 0);
+    REQUIRE(counters.events == per_object);
+    readout_destroy(efu);
+  }
+  // short-lived objects do not pile up in what the thread remembers
+  for (int i = 0; i < 1000; ++i) {
+    auto * efu = readout_create(addr, port, 8888, 1 / 14., 0x34);
+    readout_enable_multi_producer(efu);
+    readout_add_caen(efu, 1, 0, 0., 0., &caen_data);
+    readout_destroy(efu);
+  }
+}
+
+TEST_CASE("Readouts fed through shared memory are sent by the aggregator","[c][CAEN][shared]"){
+  const uint16_t max{3000};
+  int detector_port = find_port();
+  auto stats = std::make_shared<CaenStats>();
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port, receive_caen(stats));
+  REQUIRE(detector_receiver.isRunning());
+
+  // the name must be unique on this host
+  const auto name = "readout-test-" + std::to_string(detector_port);
+  char addr[] = "127.0.0.1";
+  {
+    auto aggregator = readout_create(addr, detector_port, 8888, 1 / 14., 0x34);
+    REQUIRE(readout_aggregate_shared(aggregator, name.c_str(), 4) == 0);
+    // in practice another process; nothing listens on its own port
+    auto feeder = readout_create(addr, find_port(), 8888, 1 / 14., 0x34);
+    REQUIRE(readout_feed_shared(feeder, name.c_str()) == 0);
+    std::thread feeding([feeder, max](){
+      CAEN_readout_t caen_data{7, 0, 0, 0, 0};
+      for (uint16_t i = 0; i < max; ++i) {
+        caen_data.a = i;
+        readout_add_caen(feeder, 1, 0, static_cast<double>(i) / max, 0., &caen_data);
+      }
+      readout_destroy(feeder);
+    });
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) {
+      caen_data.a = i;
+      readout_add_caen(aggregator, 1, 0, static_cast<double>(i) / max, 0., &caen_data);
+    }
+    feeding.join();
+    readout_destroy(aggregator);
+  }
+  for (int wait = 0; wait < 10 && stats->readouts < 2 * max; ++wait){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->out_of_order == 0);
+  // the feeder's readouts are those of tube 7
+  std::lock_guard lock(stats->mutex);
+  REQUIRE(stats->tubes == std::map<uint16_t, int>{{3, max}, {7, max}});
+}
+
+TEST_CASE("A feeder gives up on an aggregator which stopped taking readouts","[c][CAEN][shared]"){
+  const uint16_t max{3000};
+  const auto name = "readout-test-" + std::to_string(find_port());
+  // an aggregator which never empties its single slot
+  SharedRing ring(name, 1);
+  REQUIRE(ring.valid());
+  char addr[] = "127.0.0.1";
+  readout_stats_t counters;
+  {
+    auto feeder = readout_create(addr, find_port(), 8888, 1 / 14., 0x34);
+    readout_silent(feeder);
+    REQUIRE(readout_feed_shared(feeder, name.c_str()) == 0);
+    CAEN_readout_t caen_data{7, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) readout_add_caen(feeder, 1, 0, static_cast<double>(i) / max, 0., &caen_data);
+    REQUIRE(readout_stats(feeder, &counters) == 0);
+    readout_destroy(feeder);
+  }
+  // the first staging buffer went into the slot, and (at least) the next ones were discarded
+  PacketPool pool;
+  size_t kept{0};
+  REQUIRE(ring.pop(pool, 16, [&](Packet staged){kept += (staged->size - sizeof(PacketHeaderV0)) / sizeof(struct CaenData);}) == 1);
+  REQUIRE(counters.abandoned > 0);
+  REQUIRE(kept + counters.abandoned <= max);
+}
+
+TEST_CASE("Senders sharing a pulse reference agree on pulse times","[c][CAEN][reference]"){
+  const uint16_t max{1000};
+  const double frequency{100};
+  int detector_port = find_port();
+  auto stats = std::make_shared<CaenStats>();
+  auto mixed = std::make_shared<std::atomic<int>>(0);
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port,
+      receive_caen(stats, [mixed](const PacketHeaderV0 & header, const CaenData * caen, size_t readouts, const CaenStats &){
+        // even sequence numbers belong to the first sender, odd to the second
+        const auto tube = header.SeqNum % 2 ? 5 : 3;
+        for (size_t i = 0; i < readouts; ++i) if (caen[i].Tube != tube) (*mixed)++;
+      }));
+  REQUIRE(detector_receiver.isRunning());
+
+  char addr[] = "127.0.0.1";
+  uint32_t high, low, prev_high, prev_low;
+  {
+    // in practice in different processes, e.g., MPI ranks
+    auto first = readout_create(addr, detector_port, 8888, frequency, 0x34);
+    readout_get_pulse_reference(first, &high, &low, &prev_high, &prev_low);
+    // the second sender would otherwise count its pulses from a later time
+    std::this_thread::sleep_for(std::chrono::milliseconds(3));
+    auto second = readout_create(addr, detector_port, 8888, frequency, 0x34);
+    readout_set_pulse_reference(second, high, low, prev_high, prev_low);
+    readout_set_sequence(first, 0, 2);
+    readout_set_sequence(second, 1, 2);
+    CAEN_readout_t first_data{3, 0, 0, 0, 0};
+    CAEN_readout_t second_data{5, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) {
+      first_data.a = second_data.a = i;
+      readout_add_caen(first, 1, 0, 0., 0., &first_data);
+      readout_add_caen(second, 1, 0, 0., 0., &second_data);
+      // spread the readouts over several pulses
+      if (i % 100 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(7));
+    }
+    readout_destroy(first);
+    readout_destroy(second);
+  }
+  for (int wait = 0; wait < 10 && stats->readouts < 2 * max; ++wait){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == 2 * max);
+  REQUIRE(stats->repeated == 0);
+  REQUIRE(*mixed == 0);
+  // every pulse time is a whole number of periods after the reference
+  const auto reference = efu_time(high, low).total_ticks();
+  const auto period = efu_time(1 / frequency).total_ticks();
+  std::lock_guard lock(stats->mutex);
+  REQUIRE(stats->pulses.size() > 1);
+  for (const auto & [pulse, readouts]: stats->pulses) {
+    REQUIRE(pulse >= reference);
+    REQUIRE((pulse - reference) % period == 0);
+  }
+}
+
+TEST_CASE("Components attached by name share one Readout object","[c][CAEN][attach]"){
+  const uint16_t max{1000};
+  int detector_port = find_port();
+  auto stats = std::make_shared<CaenStats>();
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port, receive_caen(stats));
+  REQUIRE(detector_receiver.isRunning());
+
+  char addr[] = "127.0.0.1";
+  const auto name = "attach-test-" + std::to_string(detector_port);
+  {
+    auto first = readout_attach(name.c_str(), addr, detector_port, 8888, 14., 0x34);
+    auto second = readout_attach(name.c_str(), addr, detector_port, 8888, 14., 0x34);
+    REQUIRE(first != nullptr);
+    REQUIRE(first == second);
+    REQUIRE(readout_attachments(first) == 2);
+    // a different destination can not use the same name
+    REQUIRE(readout_attach(name.c_str(), addr, detector_port + 1, 8888, 14., 0x34) == nullptr);
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) {
+      caen_data.a = i;
+      readout_add_caen(i % 2 ? first : second, 1, 0, 0., 0., &caen_data);
+    }
+    // the first release leaves the other attachment working
+    readout_destroy(first);
+    REQUIRE(readout_attachments(second) == 1);
+    readout_add_caen(second, 1, 0, 0., 0., &caen_data);
+    readout_destroy(second);
+    // the name is free again
+    auto third = readout_attach(name.c_str(), addr, detector_port, 8888, 14., 0x34);
+    REQUIRE(readout_attachments(third) == 1);
+    readout_disable_network(third);
+    readout_destroy(third);
+  }
+  for (int wait = 0; wait < 10 && stats->readouts < max + 1; ++wait){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == max + 1);
+  REQUIRE(stats->out_of_order == 0);
+  // the readouts of both attachments share packets
+  REQUIRE(stats->packets < 10);
+}
+
+TEST_CASE("Readouts following one pulse clock share pulse times","[c][CAEN][clock]"){
+  const uint16_t max{1000};
+  const double frequency{100};
+  const std::array stats{std::make_shared<CaenStats>(), std::make_shared<CaenStats>()};
+  const int detector_port = find_port();
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port, receive_caen(stats[0]));
+  const int monitor_port = find_port();
+  cluon::UDPReceiver monitor_receiver("127.0.0.1", monitor_port, receive_caen(stats[1]));
+  REQUIRE(detector_receiver.isRunning());
+  REQUIRE(monitor_receiver.isRunning());
+
+  char addr[] = "127.0.0.1";
+  {
+    auto clock = readout_clock_attach("clock-test", frequency);
+    REQUIRE(clock != nullptr);
+    REQUIRE(readout_clock_attach("clock-test", frequency / 2) == nullptr);
+    auto detector = readout_create(addr, detector_port, 8888, frequency, 0x34);
+    // created later, so with its own clock its pulses would be out of step
+    std::this_thread::sleep_for(std::chrono::milliseconds(3));
+    auto monitor = readout_create(addr, monitor_port, 8888, frequency, 0x34);
+    readout_follow_clock(detector, clock);
+    readout_follow_clock(monitor, clock);
+    // the followers keep the clock running
+    readout_clock_detach(clock);
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) {
+      caen_data.a = i;
+      readout_add_caen(detector, 1, 0, 0., 0., &caen_data);
+      readout_add_caen(monitor, 1, 0, 0., 0., &caen_data);
+      // spread the readouts over several pulses
+      if (i % 100 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(7));
+    }
+    readout_destroy(detector);
+    readout_destroy(monitor);
+  }
+  for (int wait = 0; wait < 10 && stats[0]->readouts + stats[1]->readouts < 2 * max; ++wait){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats[0]->readouts == max);
+  REQUIRE(stats[1]->readouts == max);
+  std::scoped_lock lock(stats[0]->mutex, stats[1]->mutex);
+  REQUIRE(stats[0]->pulses.size() > 1);
+  // readouts added together are stamped with the same pulse time, unless the pulse moved on in between
+  const auto period = efu_time(1 / frequency).total_ticks();
+  const auto first = std::min(stats[0]->pulses.begin()->first, stats[1]->pulses.begin()->first);
+  for (const auto & received: stats) for (const auto & [pulse, readouts]: received->pulses) REQUIRE((pulse - first) % period == 0);
+}
+
+TEST_CASE("A simulated clock moves on per event added","[c][CAEN][simulated]"){
+  const uint16_t max{1000};
+  const int per_pulse{100};
+  const double frequency{14};
+  auto stats = std::make_shared<CaenStats>();
+  const int detector_port = find_port();
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port, receive_caen(stats));
+  REQUIRE(detector_receiver.isRunning());
+
+  const bool multi_producer = GENERATE(false, true);
+  char addr[] = "127.0.0.1";
+  const auto period = efu_time(1 / frequency);
+  const auto origin = efu_time(1000u, 0u);
+  const auto before = origin - period;
+  {
+    auto detector_efu = readout_create(addr, detector_port, 8888, frequency, 0x34);
+    REQUIRE(readout_set_clock(detector_efu, READOUT_CLOCK_EVENTS, 0.) == -1);
+    REQUIRE(readout_set_clock(detector_efu, 17, 1.) == -1);
+    REQUIRE(readout_next_pulse(detector_efu) == -1);
+    REQUIRE(readout_set_clock(detector_efu, READOUT_CLOCK_EVENTS, per_pulse) == 0);
+    if (multi_producer) readout_enable_multi_producer(detector_efu);
+    readout_set_pulse_reference(detector_efu, origin.high(), origin.low(), before.high(), before.low());
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) {
+      // events still to be added stay in this pulse until it holds `per_pulse`
+      REQUIRE(readout_pulse_rolls_over(detector_efu, per_pulse - 1 - i % per_pulse) == (i && i % per_pulse == 0 ? 1 : 0));
+      REQUIRE(readout_pulse_rolls_over(detector_efu, per_pulse - i % per_pulse) == 1);
+      caen_data.a = i;
+      readout_add_caen(detector_efu, 1, 0, 0., 0., &caen_data);
+    }
+    // the remaining pulses are moved on by hand
+    REQUIRE(readout_set_clock(detector_efu, READOUT_CLOCK_MANUAL, 0.) == 0);
+    REQUIRE(readout_pulse_rolls_over(detector_efu, max) == 0);
+    REQUIRE(readout_pulse_rolls_over(nullptr, 0) == -1);
+    REQUIRE(readout_next_pulse(detector_efu) == 0);
+    readout_add_caen(detector_efu, 1, 0, 0., 0., &caen_data);
+    REQUIRE(readout_next_pulse(detector_efu) == 0);
+    REQUIRE(readout_next_pulse(detector_efu) == 0);
+    readout_add_caen(detector_efu, 1, 0, 0., 0., &caen_data);
+    uint32_t phi, plo, pphi, pplo;
+    readout_get_pulse_reference(detector_efu, &phi, &plo, &pphi, &pplo);
+    REQUIRE(efu_time(phi, plo) == origin + period * (max / per_pulse + 2));
+    REQUIRE(efu_time(pphi, pplo) == origin + period * (max / per_pulse + 1));
+    readout_destroy(detector_efu);
+  }
+  for (int wait = 0; wait < 10 && stats->readouts < max + 2; ++wait){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == max + 2);
+  std::lock_guard lock(stats->mutex);
+  // every simulated pulse holds the readouts of exactly `per_pulse` events, however long they took to add
+  std::map<uint64_t, int> expected;
+  for (uint32_t pulse = 0; pulse < max / per_pulse; ++pulse) expected[(origin + period * pulse).total_ticks()] = per_pulse;
+  expected[(origin + period * (max / per_pulse)).total_ticks()] = 1;
+  expected[(origin + period * (max / per_pulse + 2)).total_ticks()] = 1;
+  REQUIRE(stats->pulses == expected);
+}
+
+TEST_CASE("Readout counters match what was sent","[c][CAEN][stats]"){
+  const uint16_t max{2000};
+  const double frequency{100};
+  int detector_port = find_port();
+  auto stats = std::make_shared<CaenStats>();
+  cluon::UDPReceiver detector_receiver("127.0.0.1", detector_port, receive_caen(stats));
+  REQUIRE(detector_receiver.isRunning());
+
+  const bool multi_producer = GENERATE(false, true);
+  char addr[] = "127.0.0.1";
+  readout_stats_t counters;
+  {
+    auto detector_efu = readout_create(addr, detector_port, 8888, frequency, 0x34);
+    REQUIRE(readout_stats(detector_efu, nullptr) == -1);
+    if (multi_producer) readout_enable_multi_producer(detector_efu);
+    readout_rand_seed(detector_efu, 1);
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    for (uint16_t i = 0; i < max; ++i) {
+      caen_data.a = i;
+      // noise readouts are sent once, weighted ones a Poisson-distributed number of times
+      readout_add_caen(detector_efu, 1, 0, 0., i % 2 ? 0. : 2., &caen_data);
+      // let the pulse time roll over with packets partly filled
+      if (i == max / 2) std::this_thread::sleep_for(std::chrono::milliseconds(25));
+    }
+    readout_send(detector_efu);
+    REQUIRE(readout_stats(detector_efu, &counters) == 0);
+    readout_destroy(detector_efu);
+  }
+  REQUIRE(counters.events == max);
+  REQUIRE(counters.readouts > max);
+  REQUIRE(counters.pulse_flushes >= 1);
+  REQUIRE(counters.send_errors == 0);
+  REQUIRE(counters.dropped == 0);
+  REQUIRE(counters.written_rows == 0);
+  REQUIRE(counters.bytes == counters.packets * sizeof(PacketHeaderV0) + counters.readouts * sizeof(struct CaenData));
+  uint64_t timed{0};
+  for (const auto count: counters.latency) timed += count;
+  REQUIRE(timed == counters.packets);
+  for (int wait = 0; wait < 10 && stats->readouts < static_cast<int>(counters.readouts); ++wait){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  REQUIRE(stats->readouts == static_cast<int>(counters.readouts));
+  REQUIRE(stats->packets == static_cast<int>(counters.packets));
+}
+
+TEST_CASE("Diagnostic messages from several threads are all written","[log]"){
+  const int threads{4};
+  const int count{1000};
+  std::ostringstream captured;
+  auto * original = std::cout.rdbuf(captured.rdbuf());
+  {
+    std::vector<std::thread> writers;
+    for (int t = 0; t < threads; ++t) {
+      writers.emplace_back([t](){
+        for (int i = 0; i < count; ++i) LogSink::instance().write("thread " + std::to_string(t) + " message " + std::to_string(i));
+      });
+    }
+    for (auto & writer: writers) writer.join();
+    LogSink::instance().flush();
+  }
+  std::cout.rdbuf(original);
+  const auto text = captured.str();
+  REQUIRE(std::count(text.begin(), text.end(), '\n') == threads * count);
+  // each thread's messages stay in order
+  REQUIRE(text.find("thread 0 message 999") > text.find("thread 0 message 998"));
+}
@@ -0,0 +1,76 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <Readout.h>
+#include <stage_timer.h>
+#include "test_utils.h"
+
+TEST_CASE("Stage histogram bins cover every duration","[timing]"){
+  // bins are contiguous, and each holds the durations from its lower edge
+  for (size_t i = 0; i + 1 < StageHistogram::Bins; ++i) {
+    REQUIRE(StageHistogram::lower(i) + StageHistogram::width(i) == StageHistogram::lower(i + 1));
+    REQUIRE(StageHistogram::bin(StageHistogram::lower(i)) == i);
+  }
+  REQUIRE(StageHistogram::bin(~uint64_t(0)) == StageHistogram::Bins - 1);
+
+  StageHistogram h;
+  for (uint64_t ns = 1; ns <= 1000; ++ns) h.record(ns);
+  REQUIRE(h.count() == 1000);
+  REQUIRE(h.total() == 500500);
+  REQUIRE(h.max() == 1000);
+  // percentiles are known to within an eighth
+  for (const auto q: {0.5, 0.9, 0.99}) {
+    const auto p = static_cast<double>(h.percentile(q));
+    REQUIRE(p > 1000 * q * 7 / 8);
+    REQUIRE(p < 1000 * q * 9 / 8);
+  }
+}
+
+TEST_CASE("Stage laps leave out nested stages timed on their own","[timing]"){
+  StageTimes times;
+  StageLaps laps(&times);
+  // a nested stage longer than the lap leaves nothing of it
+  StageLaps::exclude(std::chrono::hours(1));
+  laps(Stage::pack);
+  REQUIRE(times.stages[static_cast<size_t>(Stage::pack)].max() == 0);
+  // and is only left out of the lap it happened in
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  laps(Stage::pack);
+  REQUIRE(times.stages[static_cast<size_t>(Stage::pack)].max() >= 2000000);
+  // nor does it reach laps started afterwards
+  StageLaps later(&times);
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  later(Stage::write);
+  REQUIRE(times.stages[static_cast<size_t>(Stage::write)].max() >= 2000000);
+}
+
+TEST_CASE("Stage timing is written when the Readout object is destroyed","[c][CAEN][timing]"){
+  const auto filename = (std::filesystem::temp_directory_path() / ("stage_timing_" + std::to_string(find_port()) + ".json")).string();
+  char addr[] = "127.0.0.1";
+  const size_t count{1000};
+  {
+    auto detector_efu = readout_create(addr, find_port(), 8888, 14., 0x34);
+    readout_enable_stage_timing(detector_efu, filename.c_str());
+    CAEN_readout_t caen_data{3, 0, 0, 0, 0};
+    for (size_t i = 0; i < count; ++i) readout_add_caen(detector_efu, 1, 0, 0., 1., &caen_data);
+    readout_destroy(detector_efu);
+  }
+  std::ifstream in(filename);
+  REQUIRE(in.good());
+  std::stringstream text;
+  text << in.rdbuf();
+  const auto json = text.str();
+  for (const auto * stage: {"\"efu_time\": {\"count\": 1000,", "\"poisson\": {\"count\": 1000,", "\"pack\": {\"count\": 1000,",
+                            "\"write\": {\"count\": 0,", "\"send\": {\"count\": "}) {
+    REQUIRE(json.find(stage) != std::string::npos);
+  }
+  // at least the last packet was sent on destruction
+  REQUIRE(json.find("\"send\": {\"count\": 0,") == std::string::npos);
+  in.close();
+  std::filesystem::remove(filename);
+}
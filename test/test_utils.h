@@ -1,8 +1,73 @@
 #pragma once
 #include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include <Structs.h>
+#include <efu_time.h>
+
+// An unused UDP port number
+int find_port();
 
 class UDPStats {
 public:
   std::atomic<int> packets{0};
   std::atomic<int> readouts{0};
-};
\ No newline at end of file
+};
+
+// What a test receiver saw of the CAEN packets sent to one port
+class CaenStats {
+public:
+  std::atomic<int> packets{0};
+  std::atomic<int> readouts{0};
+  // packets not numbered one after the previous packet of their output queue, or numbered like an earlier one
+  std::atomic<int> out_of_order{0};
+  std::atomic<int> repeated{0};
+
+  // the rest is guarded by the mutex
+  std::mutex mutex;
+  std::map<uint64_t, int> pulses;  // readouts per pulse time, in ticks
+  std::map<uint8_t, int> rings;    // readouts per ring
+  std::map<uint16_t, int> tubes;   // readouts per tube
+  std::map<uint8_t, int> queues;   // packets per output queue
+  std::map<uint8_t, int64_t> last_sequence;
+  std::set<std::pair<uint8_t, uint32_t>> sequences;
+
+  void record(const PacketHeaderV0 & header, const CaenData * caen, const size_t count) {
+    std::lock_guard lock(mutex);
+    const auto last = last_sequence.try_emplace(header.OutputQueue, -1).first;
+    if (static_cast<int64_t>(header.SeqNum) != last->second + 1) out_of_order++;
+    last->second = header.SeqNum;
+    if (!sequences.emplace(header.OutputQueue, header.SeqNum).second) repeated++;
+    ++queues[header.OutputQueue];
+    pulses[efu_time(header.PulseHigh, header.PulseLow).total_ticks()] += static_cast<int>(count);
+    for (size_t i = 0; i < count; ++i) {
+      ++rings[caen[i].Ring];
+      ++tubes[caen[i].Tube];
+    }
+    packets++;
+    readouts += static_cast<int>(count);
+  }
+};
+
+// A cluon::UDPReceiver callback recording every CAEN packet in `stats`, after handing its header and readouts,
+// and the stats before this packet, to `inspect` for the checks of one test
+template<class Inspect>
+auto receive_caen(std::shared_ptr<CaenStats> stats, Inspect inspect) {
+  return [stats = std::move(stats), inspect](std::string && data, std::string &&, std::chrono::system_clock::time_point &&) noexcept {
+    const auto * header = reinterpret_cast<const PacketHeaderV0 *>(data.data());
+    const auto * caen = reinterpret_cast<const CaenData *>(data.data() + sizeof(PacketHeaderV0));
+    const auto count = (header->TotalLength - sizeof(PacketHeaderV0)) / sizeof(struct CaenData);
+    inspect(*header, caen, count, *stats);
+    stats->record(*header, caen, count);
+  };
+}
+inline auto receive_caen(std::shared_ptr<CaenStats> stats) {
+  return receive_caen(std::move(stats), [](const PacketHeaderV0 &, const CaenData *, size_t, const CaenStats &){});
+}